@@ -2,6 +2,168 @@
 
 #include <yaml_cpp_struct.hpp>
 
+struct SchedulerConfig {
+    // 0 means no limit, requests are dispatched to providers immediately
+    std::size_t max_concurrent_requests{0};
+    std::size_t max_queued_requests{1024};
+    std::size_t queue_timeout{60};
+    std::size_t quantum{1};
+    // while both lanes are backlogged, one batch request is dispatched per this many interactive ones
+    std::size_t batch_lane_share{4};
+};
+YCS_ADD_STRUCT(SchedulerConfig, max_concurrent_requests, max_queued_requests, queue_timeout, quantum, batch_lane_share)
+
+struct RateLimitRule {
+    // empty path or model matches everything, the first matching rule wins
+    std::string path;
+    std::string model;
+    // requests per second
+    double rate{1};
+    std::size_t burst{10};
+};
+YCS_ADD_STRUCT(RateLimitRule, path, model, rate, burst)
+
+struct ConnectionConfig {
+    // further caps the budget derived from RLIMIT_NOFILE, 0 means no extra cap
+    std::size_t max_connections{0};
+    // seconds allowed for the request line and headers, then for the body, once the first byte arrived
+    std::size_t header_timeout{30};
+    std::size_t body_timeout{60};
+    // the keep-alive idle timeout (interval) shrinks towards this as connections approach max_connections
+    std::size_t min_idle_timeout{5};
+};
+YCS_ADD_STRUCT(ConnectionConfig, max_connections, header_timeout, body_timeout, min_idle_timeout)
+
+struct UpstreamTimeoutConfig {
+    // seconds allowed for each phase of an upstream request, the tls handshake includes a proxy CONNECT
+    std::size_t connect{10};
+    std::size_t tls{10};
+    // from sending the request until the response header arrived
+    std::size_t first_byte{30};
+    // between two reads of a streamed response
+    std::size_t idle{30};
+};
+YCS_ADD_STRUCT(UpstreamTimeoutConfig, connect, tls, first_byte, idle)
+
+struct TokenTimeoutRule {
+    // empty matches every provider, the first matching rule wins
+    std::string provider;
+    // seconds until the first token and between two tokens before the provider counts as stalled, 0 disables
+    std::size_t first_token{60};
+    std::size_t idle{30};
+};
+YCS_ADD_STRUCT(TokenTimeoutRule, provider, first_token, idle)
+
+struct PacingConfig {
+    // seconds a conversation may wait for its slot before the provider is reported as unavailable
+    std::size_t max_wait{10};
+    // pause after a 429 that came without a Retry-After header
+    std::size_t default_retry_after{5};
+    // requests per second, a paced provider never drops below min_rate and gains recovery back with every success
+    double min_rate{0.1};
+    double recovery{0.1};
+    // a provider whose learned rate climbs above this is no longer paced
+    double max_rate{10};
+};
+YCS_ADD_STRUCT(PacingConfig, max_wait, default_retry_after, min_rate, recovery, max_rate)
+
+struct CoalescingConfig {
+    // identical conversations to the same model share one upstream answer while it is in flight, also between
+    // different clients, so it is opt-in
+    bool enable{false};
+    // a conversation joins only while the answer produced so far is smaller, it is replayed to the new client
+    std::size_t max_replay_bytes{1 << 20};
+};
+YCS_ADD_STRUCT(CoalescingConfig, enable, max_replay_bytes)
+
+struct CredentialCacheConfig {
+    // cookies and tokens are shared between conversations until they expire, false fetches them for every one
+    bool enable{true};
+    // seconds before its expiry a credential that is read gets refreshed in the background
+    std::size_t refresh_ahead{60};
+};
+YCS_ADD_STRUCT(CredentialCacheConfig, enable, refresh_ahead)
+
+struct ConversationSessionConfig {
+    // seconds an upstream conversation is continued after the last message of the client conversation
+    std::size_t ttl{1800};
+    std::size_t max_entries{10000};
+};
+YCS_ADD_STRUCT(ConversationSessionConfig, ttl, max_entries)
+
+struct SessionPoolRule {
+    // huggingChat or chatGptDemo
+    std::string provider;
+    // upstream sessions kept ready
+    std::size_t size{2};
+    // seconds a ready session is handed out at most, upstreams close idle connections
+    std::size_t max_age{30};
+};
+YCS_ADD_STRUCT(SessionPoolRule, provider, size, max_age)
+
+struct ResponseCacheConfig {
+    // opt-in, only answers of these models are cached
+    std::vector<std::string> models;
+    std::size_t max_bytes{64 << 20};
+    // seconds a cached answer is served
+    std::size_t ttl{3600};
+    // a hit is replayed in chunks of this many bytes, one every replay_interval milliseconds, 0 sends it at once
+    std::size_t replay_chunk{0};
+    std::size_t replay_interval{20};
+    // answers are also kept in memory mapped segment files of this size (at most 4 GiB) under persist_dir, empty
+    // disables it
+    std::string persist_dir;
+    std::size_t segment_size{64 << 20};
+    // the oldest segments are evicted while they take more than this on disk, 0 is unbounded
+    std::size_t max_disk_bytes{1 << 30};
+};
+YCS_ADD_STRUCT(ResponseCacheConfig, models, max_bytes, ttl, replay_chunk, replay_interval, persist_dir, segment_size,
+               max_disk_bytes)
+
+struct HedgeConfig {
+    // virtual model listed next to the providers
+    std::string model{"auto-hedged"};
+    // started in this order, the next one whenever none of the running ones produced a token for delay milliseconds
+    std::vector<std::string> providers;
+    std::size_t delay{2000};
+};
+YCS_ADD_STRUCT(HedgeConfig, model, providers, delay)
+
+struct FailoverConfig {
+    std::string model;
+    // ranked, a provider is only asked after the one before it failed without producing a token
+    std::vector<std::string> providers;
+};
+YCS_ADD_STRUCT(FailoverConfig, model, providers)
+
+struct RouterConfig {
+    std::string model{"auto"};
+    // empty means every registered provider
+    std::vector<std::string> providers;
+    // share of conversations sent to a random provider so the statistics of the others stay fresh
+    double exploration{0.1};
+    // providers tried in score order before giving up
+    std::size_t max_attempts{3};
+};
+YCS_ADD_STRUCT(RouterConfig, model, providers, exploration, max_attempts)
+
+struct CircuitBreakerConfig {
+    // outcomes of the last this many conversations of a provider are considered, at least min_calls of them
+    std::size_t window{20};
+    std::size_t min_calls{5};
+    // shares of the window that open the breaker
+    double failure_rate{0.5};
+    double slow_call_rate{0.8};
+    // milliseconds until the first token after which a successful conversation still counts as slow
+    std::size_t slow_call_threshold{15000};
+    // seconds an open breaker fails fast before it lets probes through
+    std::size_t open_duration{30};
+    // successful probes that close a half-open breaker, at most this many run at once
+    std::size_t half_open_probes{2};
+};
+YCS_ADD_STRUCT(CircuitBreakerConfig, window, min_calls, failure_rate, slow_call_rate, slow_call_threshold,
+               open_duration, half_open_probes)
+
 struct Config {
     std::string client_root_path;
     std::size_t interval{300};
@@ -15,6 +177,25 @@ struct Config {
     std::string api_key;
     std::vector<std::string> ip_white_list;
     std::string zeus{"http://127.0.0.1:8860"};
+    SchedulerConfig scheduler;
+    std::vector<RateLimitRule> rate_limits;
+    ConnectionConfig connection;
+    std::vector<HedgeConfig> hedged_models;
+    std::vector<FailoverConfig> failover_models;
+    std::vector<RouterConfig> routed_models;
+    CircuitBreakerConfig circuit_breaker;
+    UpstreamTimeoutConfig upstream_timeouts;
+    std::vector<TokenTimeoutRule> token_timeouts;
+    PacingConfig pacing;
+    CoalescingConfig coalescing;
+    ResponseCacheConfig response_cache;
+    CredentialCacheConfig credentials;
+    std::vector<SessionPoolRule> session_pools;
+    ConversationSessionConfig conversation_sessions;
+    // bearer token of the admin endpoints, empty disables them
+    std::string admin_token;
 };
 YCS_ADD_STRUCT(Config, client_root_path, interval, work_thread_num, host, port, chat_path, providers, enable_proxy,
-               http_proxy, api_key, ip_white_list, zeus)
+               http_proxy, api_key, ip_white_list, zeus, scheduler, rate_limits, connection, hedged_models,
+               failover_models, routed_models, circuit_breaker, upstream_timeouts, token_timeouts, pacing,
+               coalescing, response_cache, credentials, session_pools, conversation_sessions, admin_token)
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "cfg.h"
+
+// Per provider breaker over the outcomes of its last conversations. Too many failures or slow first tokens open it,
+// an open provider is refused at once (and hidden from the model list) for open_duration seconds, then a few probe
+// conversations are let through in the half-open state and decide whether it closes or opens again.
+class CircuitBreaker final {
+public:
+    enum class State : uint8_t {
+        Closed,
+        Open,
+        HalfOpen,
+    };
+
+    // Handed out for every admitted conversation, outcomes of permits from before a state change are ignored.
+    struct Permit {
+        std::string provider;
+        uint64_t generation{0};
+    };
+
+    explicit CircuitBreaker(const CircuitBreakerConfig&);
+
+    // std::nullopt while the provider is open or all half-open probes are running, a permit has to be followed by
+    // exactly one of onSuccess, onFailure or onAbandoned
+    std::optional<Permit> tryAcquire(const std::string& /* provider */);
+    void onSuccess(const Permit&, std::chrono::milliseconds /* ttft */);
+    void onFailure(const Permit&);
+    // the outcome says nothing about the provider, e.g. another one won a hedged race
+    void onAbandoned(const Permit&);
+
+    // false while the provider is refused, used to hide it from the model list
+    bool available(const std::string& /* provider */);
+
+    nlohmann::json metrics();
+
+private:
+    enum Outcome : uint8_t {
+        Succeeded = 0,
+        Failed = 1,
+        Slow = 2,
+    };
+
+    struct Breaker {
+        State state{State::Closed};
+        uint64_t generation{0};
+        // ring buffer of the last window outcomes
+        std::vector<uint8_t> outcomes;
+        std::size_t next{0};
+        std::chrono::steady_clock::time_point opened_at;
+        std::size_t probes_running{0};
+        std::size_t probes_succeeded{0};
+        uint64_t opened{0};
+        uint64_t rejected{0};
+    };
+
+    static std::string_view stateName(State);
+
+    // the breaker of a permit if the permit is still current
+    Breaker* current(const Permit&);
+    void record(Breaker&, const std::string& /* provider */, uint8_t /* outcome */);
+    void transition(Breaker&, const std::string& /* provider */, State);
+
+    CircuitBreakerConfig m_cfg;
+    std::mutex m_mtx;
+    std::unordered_map<std::string, Breaker> m_breakers;
+};
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <boost/asio/awaitable.hpp>
+#include <nlohmann/json.hpp>
+
+#include "cfg.h"
+#include "conversation_key.h"
+#include "dispatcher.h"
+#include "helper.hpp"
+
+// Singleflight for conversations: a conversation identical to one in flight for the same model (same messages,
+// surrounding whitespace ignored) doesn't reach the provider again. It joins the running answer, gets everything
+// produced so far replayed and then the rest live.
+class Coalescer final {
+public:
+    explicit Coalescer(const CoalescingConfig&);
+
+    // answers the conversation with func, or with the identical one already in flight
+    boost::asio::awaitable<void> run(const std::string& /* model */, const GptCallback&,
+                                     std::shared_ptr<FreeGpt::Channel>, nlohmann::json);
+
+    nlohmann::json metrics();
+
+private:
+    struct Flight {
+        std::size_t hash{0};
+        std::string key;
+        std::shared_ptr<FreeGpt::Channel> upstream;
+        // guards everything below
+        std::mutex mtx;
+        std::vector<std::pair<boost::system::error_code, std::string>> messages;
+        std::size_t bytes{0};
+        std::size_t subscribers{1};
+        bool done{false};
+        std::vector<std::shared_ptr<AsyncSignal>> waiters;
+    };
+
+    boost::asio::awaitable<void> relay(std::shared_ptr<Flight>);
+    boost::asio::awaitable<void> subscribe(std::shared_ptr<Flight>, std::shared_ptr<FreeGpt::Channel>);
+    void leave(const std::shared_ptr<Flight>&);
+
+    CoalescingConfig m_cfg;
+    std::mutex m_mtx;
+    std::unordered_map<std::size_t, std::shared_ptr<Flight>> m_flights;
+    std::atomic<uint64_t> m_started{0};
+    std::atomic<uint64_t> m_joined{0};
+};
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <optional>
+
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <nlohmann/json.hpp>
+
+#include "cfg.h"
+#include "helper.hpp"
+
+// Caps the number of open client connections. The budget is derived from RLIMIT_NOFILE (each client may hold an
+// upstream socket as well) and further capped by connection.max_connections. When the budget is used up the acceptor
+// stops accepting and lets the kernel backlog queue, when the process still runs out of descriptors a spare fd is
+// given up to accept the pending client and close it with a 503 instead of spinning on EMFILE.
+class ConnectionGovernor final {
+public:
+    // Counts one open connection, the slot is released on destruction.
+    class Lease final {
+    public:
+        Lease() = default;
+        explicit Lease(ConnectionGovernor*);
+        Lease(Lease&&) noexcept;
+        Lease& operator=(Lease&&) noexcept;
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+        ~Lease();
+
+    private:
+        ConnectionGovernor* m_governor{nullptr};
+    };
+
+    explicit ConnectionGovernor(const ConnectionConfig&);
+    ~ConnectionGovernor();
+
+    // waits (with the listen backlog queueing the clients) until a connection slot is free
+    boost::asio::awaitable<Lease> acquire();
+
+    // handles a failed accept, returns false when the acceptor was closed and the accept loop should stop
+    boost::asio::awaitable<bool> onAcceptError(boost::asio::ip::tcp::acceptor&, const boost::system::error_code&);
+    void onAccepted();
+
+    std::size_t active() const { return m_active.load(std::memory_order_relaxed); }
+    std::size_t limit() const { return m_limit; }
+
+    nlohmann::json metrics();
+
+private:
+    static constexpr auto MIN_BACKOFF = std::chrono::milliseconds(10);
+    static constexpr auto MAX_BACKOFF = std::chrono::milliseconds(1000);
+
+    void release();
+    void rejectWithSpareFd(boost::asio::ip::tcp::acceptor&);
+
+    std::size_t m_limit{0};
+    int m_spare_fd{-1};
+    std::atomic<std::size_t> m_active{0};
+    std::chrono::milliseconds m_backoff{0};
+
+    std::mutex m_mtx;
+    std::shared_ptr<AsyncSignal> m_waiter;
+    std::atomic<uint64_t> m_accepted{0};
+    std::atomic<uint64_t> m_queued{0};
+    std::atomic<uint64_t> m_rejected{0};
+    std::atomic<uint64_t> m_accept_errors{0};
+};
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include <nlohmann/json.hpp>
+
+// Identifies a conversation for coalescing and caching: the model plus role and content of every message with
+// surrounding whitespace trimmed. std::nullopt when the request carries no conversation.
+inline std::optional<std::string> conversationKey(const std::string& model, const nlohmann::json& json) {
+    auto append_trimmed = [](std::string& key, std::string_view str) {
+        auto begin = str.find_first_not_of(" \t\r\n");
+        if (begin != std::string_view::npos)
+            key.append(str.substr(begin, str.find_last_not_of(" \t\r\n") - begin + 1));
+        key.push_back('\0');
+    };
+    auto meta = json.find("meta");
+    if (meta == json.end() || !meta->contains("content"))
+        return std::nullopt;
+    auto& content = meta->at("content");
+    auto conversation = content.find("conversation");
+    auto parts = content.find("parts");
+    if (conversation == content.end() || parts == content.end() || !conversation->is_array() || !parts->is_array())
+        return std::nullopt;
+    std::string key{model};
+    key.push_back('\0');
+    for (auto messages : {conversation, parts}) {
+        for (auto& message : *messages) {
+            if (!message.is_object() || !message.contains("content") || !message["content"].is_string())
+                return std::nullopt;
+            append_trimmed(key, message.value("role", ""));
+            append_trimmed(key, message["content"].get_ref<const std::string&>());
+        }
+    }
+    return key;
+}
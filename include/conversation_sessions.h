@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include <nlohmann/json.hpp>
+
+#include "cfg.h"
+
+// Upstream state of client conversations, keyed by the provider, the client (the "client" main sets from the remote ip
+// and the hash of the api key) and the conversation_id chat.js sends, so a provider that keeps the thread server side
+// continues it with the new message only, and only for the client that started it. A state is valid for the turn after
+// the one that stored it: when the client's history no longer has the expected length (a message was edited, removed
+// or answered elsewhere) the conversation starts upstream from scratch. Unused states are evicted after ttl seconds.
+class ConversationSessions final {
+public:
+    explicit ConversationSessions(const ConversationSessionConfig&);
+
+    std::optional<nlohmann::json> find(const std::string& /* provider */, const nlohmann::json& /* request */);
+    // the state the next message of the conversation continues from
+    void store(const std::string& /* provider */, const nlohmann::json& /* request */, nlohmann::json /* state */);
+    void erase(const std::string& /* provider */, const nlohmann::json& /* request */);
+
+    nlohmann::json metrics();
+
+private:
+    struct Item {
+        std::string key;
+        nlohmann::json state;
+        std::size_t history{0};
+        std::chrono::steady_clock::time_point expires_at;
+    };
+
+    // std::nullopt when the request carries no client or conversation_id
+    static std::optional<std::string> key(const std::string& /* provider */, const nlohmann::json& /* request */);
+    static std::size_t history(const nlohmann::json& /* request */);
+    // drops expired and surplus items from the least recently used end, m_mtx held
+    void evict();
+
+    ConversationSessionConfig m_cfg;
+    std::mutex m_mtx;
+    // most recently used first
+    std::list<Item> m_items;
+    std::unordered_map<std::string_view, std::list<Item>::iterator> m_index;
+    std::atomic<uint64_t> m_hits{0};
+    std::atomic<uint64_t> m_misses{0};
+    std::atomic<uint64_t> m_evictions{0};
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <expected>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <boost/asio/awaitable.hpp>
+#include <boost/system/error_code.hpp>
+#include <nlohmann/json.hpp>
+
+#include "cfg.h"
+#include "helper.hpp"
+#include "provider_error.h"
+
+// Cookies and tokens providers obtain before they can ask a question, shared by every conversation until their ttl
+// runs out. A miss is fetched once while the other conversations wait for that fetch, a credential read close to
+// its expiry is refreshed in the background so conversations rarely wait at all. Each shard gets its own copy of a
+// credential with its own control block, so the reference count a read bumps and the lock bit of the atomic load
+// live on cache lines only the threads of that shard touch.
+class CredentialCache final {
+public:
+    using Result = std::expected<std::string, ProviderFailure>;
+    using Fetcher = std::function<boost::asio::awaitable<Result>()>;
+
+    explicit CredentialCache(const CredentialCacheConfig&);
+
+    // declares a credential, only at startup: the set of credentials never changes while they are read
+    void add(std::string /* name */, std::chrono::seconds /* ttl */);
+
+    boost::asio::awaitable<Result> get(const std::string& /* name */, Fetcher);
+    // drops the credential the upstream refused, unless it has been replaced already
+    void invalidate(const std::string& /* name */, const std::string& /* value */);
+
+    nlohmann::json metrics();
+
+private:
+    // a whole number of cache lines, the copies of neighbouring shards never share one
+    struct alignas(64) Credential {
+        std::string value;
+        std::chrono::steady_clock::time_point fetched_at;
+        std::chrono::steady_clock::time_point refresh_at;
+        std::chrono::steady_clock::time_point expires_at;
+    };
+
+    struct alignas(64) Shard {
+        std::atomic<std::shared_ptr<const Credential>> credential;
+    };
+
+    struct Slot {
+        std::chrono::seconds ttl;
+        std::unique_ptr<Shard[]> shards;
+        // guards everything below, only taken to fetch
+        std::mutex mtx;
+        bool fetching{false};
+        std::optional<ProviderFailure> failure;
+        std::vector<std::shared_ptr<AsyncSignal>> waiters;
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> misses{0};
+        std::atomic<uint64_t> refreshes{0};
+        std::atomic<uint64_t> failures{0};
+    };
+
+    std::shared_ptr<const Credential> load(Slot&) const;
+    // fetches and publishes, the caller has set fetching
+    boost::asio::awaitable<Result> fetch(Slot&, Fetcher);
+    // copies the credential into every shard, nullptr clears them
+    void publish(Slot&, const Credential*);
+
+    CredentialCacheConfig m_cfg;
+    std::size_t m_shard_num;
+    std::unordered_map<std::string, std::unique_ptr<Slot>> m_slots;
+};
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <random>
+#include <span>
+#include <string>
+#include <string_view>
+
+// Hashing, hex and random helpers the providers sign their requests with. Digests go through OpenSSL's one-shot EVP
+// interface, hex is encoded from a table and random values come from an engine per thread that is seeded once,
+// instead of opening std::random_device on every request.
+
+std::array<unsigned char, 16> md5Digest(std::string_view);
+std::array<unsigned char, 32> sha256Digest(std::string_view);
+
+// lower case, two characters per byte
+std::string toHex(std::span<const unsigned char>);
+
+std::mt19937_64& randomEngine();
+// length random lower case hex digits
+std::string randomHex(std::size_t /* length */);
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <chrono>
+#include <expected>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <boost/system/error_code.hpp>
+#include <nlohmann/json.hpp>
+
+#include "cfg.h"
+#include "circuit_breaker.h"
+#include "free_gpt.h"
+#include "provider_stats.h"
+#include "upstream_pacer.h"
+
+using GptCallback = std::function<boost::asio::awaitable<void>(std::shared_ptr<FreeGpt::Channel>, nlohmann::json)>;
+
+// Starts a provider on a channel of its own. The channel is closed when the provider returns, also when it threw
+// before arming its own close, so whoever reads it never waits forever.
+std::shared_ptr<FreeGpt::Channel> spawnProvider(const boost::asio::any_io_executor&, const GptCallback&,
+                                                nlohmann::json);
+
+// Sent by a virtual model right before its first token, the message names the provider serving the request.
+enum class DispatchCode {
+    ServedBy = 1,
+};
+
+template <>
+struct boost::system::is_error_code_enum<DispatchCode> : std::true_type {};
+
+boost::system::error_code make_error_code(DispatchCode);
+bool isServedBy(const boost::system::error_code&);
+
+// Serves virtual models on top of the registered providers. Every kind asks its providers in order and commits to
+// the first one that produces a token, a provider failing before that (error, empty answer, html challenge page) is
+// replaced by the next one. A hedged model also starts the next provider whenever the running ones stayed silent for
+// the hedge delay and drops the slower ones, a failover model only moves on after a failure, a routed model orders
+// the providers by their live statistics and admin weights for every conversation.
+class Dispatcher final {
+public:
+    Dispatcher(std::unordered_map<std::string, GptCallback>&, CircuitBreaker&, UpstreamPacer&);
+
+    // wraps every registered provider to collect statistics, refuse it while its circuit breaker is open, fail it
+    // with ProviderErrc::Stalled once the first matching token timeout expires and pace it after 429 answers, call
+    // before adding virtual models
+    void instrumentProviders(const std::vector<TokenTimeoutRule>&);
+
+    // register the virtual models in the provider map, unknown providers are skipped
+    void addHedgedModels(const std::vector<HedgeConfig>&);
+    void addFailoverModels(const std::vector<FailoverConfig>&);
+    void addRoutedModels(const std::vector<RouterConfig>&);
+
+    // {"model": {"provider": weight, ...}, ...} of the routed models, a weight of 0 takes a provider out of routing
+    nlohmann::json weights();
+    std::expected<void, std::string> setWeights(const nlohmann::json&);
+
+    nlohmann::json metrics();
+
+private:
+    enum class Kind : uint8_t {
+        Hedged,
+        Failover,
+        Routed,
+    };
+
+    struct VirtualModel {
+        Kind kind;
+        std::string model;
+        std::vector<std::string> providers;
+        // hedged only
+        std::optional<std::chrono::milliseconds> hedge_delay;
+        // routed only
+        double exploration{0};
+        std::size_t max_attempts{0};
+        // guarded by m_mtx
+        std::vector<double> weights;
+        uint64_t requests{0};
+        uint64_t retries{0};
+        uint64_t failed{0};
+        std::vector<uint64_t> served;
+    };
+
+    static std::string_view kindName(Kind);
+
+    void add(std::unique_ptr<VirtualModel>, const std::vector<std::string>& /* providers */);
+    // indexes into model.providers in the order they are asked
+    std::vector<std::size_t> rank(VirtualModel&);
+    boost::asio::awaitable<void> serve(VirtualModel&, std::shared_ptr<FreeGpt::Channel>, nlohmann::json);
+    boost::asio::awaitable<void> measure(std::string /* provider */, TokenTimeoutRule, GptCallback,
+                                         std::shared_ptr<FreeGpt::Channel>, nlohmann::json);
+    // waits for a pacing slot, a 429 before anything was answered is retried in the next one
+    boost::asio::awaitable<void> pace(std::string /* provider */, GptCallback, std::shared_ptr<FreeGpt::Channel>,
+                                      nlohmann::json);
+
+    std::unordered_map<std::string, GptCallback>& m_functions;
+    CircuitBreaker& m_breaker;
+    UpstreamPacer& m_pacer;
+    ProviderStats m_stats;
+    std::mutex m_mtx;
+    std::vector<std::unique_ptr<VirtualModel>> m_models;
+};
@@ -2,21 +2,28 @@
 
 #include <expected>
 #include <memory>
+#include <string>
+#include <utility>
 
 #include <boost/asio/awaitable.hpp>
 #include <boost/asio/experimental/channel.hpp>
 #include <boost/asio/thread_pool.hpp>
 #include <boost/beast.hpp>
 #include <boost/beast/ssl.hpp>
+#include <curl/curl.h>
 #include <nlohmann/json.hpp>
 
 #include "cfg.h"
+#include "conversation_sessions.h"
+#include "credential_cache.h"
+#include "provider_error.h"
+#include "session_pool.h"
 
 class FreeGpt final {
 public:
     using Channel = boost::asio::experimental::channel<void(boost::system::error_code, std::string)>;
 
-    FreeGpt(Config&);
+    FreeGpt(Config&, std::shared_ptr<CredentialCache>, std::shared_ptr<ConversationSessions>);
 
     boost::asio::awaitable<void> deepAi(std::shared_ptr<Channel>, nlohmann::json);
     boost::asio::awaitable<void> chatGptAi(std::shared_ptr<Channel>, nlohmann::json);
@@ -38,10 +45,44 @@ public:
     boost::asio::awaitable<void> noowai(std::shared_ptr<Channel>, nlohmann::json);
     boost::asio::awaitable<void> geekGpt(std::shared_ptr<Channel>, nlohmann::json);
 
+    nlohmann::json sessionPoolMetrics();
+
 private:
+    template <typename T>
+    using Setup = std::expected<T, ProviderFailure>;
+
+    // a connection with an upstream conversation opened on it
+    struct HuggingChatSession {
+        std::unique_ptr<boost::asio::ssl::context> ctx;
+        boost::beast::ssl_stream<boost::beast::tcp_stream> stream;
+        std::string cookie;
+        std::string conversation_id;
+    };
+    // a handle that is connected to the upstream and a chat created on it
+    struct ChatGptDemoSession {
+        std::unique_ptr<CURL, decltype(&curl_easy_cleanup)> curl;
+        std::string chat_id;
+    };
+
     boost::asio::awaitable<std::expected<boost::beast::ssl_stream<boost::beast::tcp_stream>, std::string>>
     createHttpClient(boost::asio::ssl::context&, std::string_view /* host */, std::string_view /* port */);
 
+    // fetchers of the credentials in m_credentials
+    boost::asio::awaitable<CredentialCache::Result> fetchYouCookie();
+    boost::asio::awaitable<CredentialCache::Result> fetchHuggingChatCookie();
+    boost::asio::awaitable<CredentialCache::Result> fetchGptalkToken();
+    boost::asio::awaitable<CredentialCache::Result> fetchChatGptDemoUserId();
+
+    // set up the sessions a conversation starts with, ahead of time when the provider has a session pool
+    boost::asio::awaitable<Setup<HuggingChatSession>> openHuggingChatSession();
+    boost::asio::awaitable<Setup<ChatGptDemoSession>> openChatGptDemoSession();
+
     Config& m_cfg;
+    // deadlines of the upstream transport phases, handed to every request this instance sends
+    UpstreamTimeoutConfig m_timeouts;
     std::shared_ptr<boost::asio::thread_pool> m_thread_pool_ptr;
+    std::shared_ptr<CredentialCache> m_credentials;
+    std::shared_ptr<ConversationSessions> m_conversations;
+    std::shared_ptr<SessionPool<HuggingChatSession>> m_hugging_chat_sessions;
+    std::shared_ptr<SessionPool<ChatGptDemoSession>> m_chat_gpt_demo_sessions;
 };
@@ -1,10 +1,13 @@
 #pragma once
 
 #include <list>
+#include <optional>
 #include <thread>
+#include <tuple>
 #include <vector>
 
 #include <boost/asio.hpp>
+#include <boost/asio/experimental/awaitable_operators.hpp>
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/uuid/uuid_io.hpp>
@@ -64,6 +67,46 @@ inline boost::asio::awaitable<void> timeout(std::chrono::seconds duration) {
     co_return;
 }
 
+// Parks a coroutine until notify() is called, notify() may come from any thread.
+class AsyncSignal final : public std::enable_shared_from_this<AsyncSignal> {
+public:
+    explicit AsyncSignal(const boost::asio::any_io_executor& executor)
+        : m_timer(executor, std::chrono::steady_clock::time_point::max()) {}
+
+    boost::asio::awaitable<void> wait() {
+        [[maybe_unused]] auto [ec] = co_await m_timer.async_wait(boost::asio::as_tuple(boost::asio::use_awaitable));
+        co_return;
+    }
+
+    void notify() {
+        // moving the expiry both cancels a pending wait and completes a wait that has not started yet
+        boost::asio::post(m_timer.get_executor(), [self = shared_from_this()] {
+            self->m_timer.expires_at(std::chrono::steady_clock::time_point::min());
+        });
+    }
+
+private:
+    boost::asio::steady_timer m_timer;
+};
+
+// co_spawn default constructs the result of a step that threw, a connected stream can't be
+template <typename T>
+inline boost::asio::awaitable<std::optional<T>> optionalStep(boost::asio::awaitable<T> step) {
+    co_return co_await std::move(step);
+}
+
+// Runs the independent steps a request needs before it can ask, connecting and fetching a credential for example,
+// at the same time on the executor of the caller. The request waits for the slowest step instead of all of them one
+// after another. The results are returned in the order of the steps, an exception of a step cancels the others.
+template <typename... T>
+inline boost::asio::awaitable<std::tuple<T...>> parallelSteps(boost::asio::awaitable<T>... steps) {
+    static_assert(sizeof...(T) >= 2, "a single step has nothing to run beside");
+    using namespace boost::asio::experimental::awaitable_operators;
+    auto results = co_await (... && optionalStep(std::move(steps)));
+    co_return std::apply([](auto&&... result) { return std::tuple<T...>{std::move(result.value())...}; },
+                         std::move(results));
+}
+
 template <typename... Args>
 inline auto getEnv(Args&&... args) {
     auto impl = []<std::size_t... I>(auto&& tp, std::index_sequence<I...>) {
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/asio/ip/address.hpp>
+
+// Binary prefix trie over ipv6 addresses, ipv4 entries are stored in their ::ffff:0:0/96 mapped form.
+// Entries are "1.2.3.4", "10.0.0.0/8", "2001:db8::/32" and the like. A lookup walks at most 128 nodes and never
+// allocates, the trie is immutable once built and reload() swaps in a new one atomically.
+class IpAllowList final {
+public:
+    using Bytes = boost::asio::ip::address_v6::bytes_type;
+
+    explicit IpAllowList(const std::vector<std::string>&);
+
+    // invalid entries are logged and skipped, a list of only invalid entries allows nobody
+    void reload(const std::vector<std::string>&);
+
+    // an empty list allows everybody, a configured one only its entries even when none of them parsed
+    bool allowed(const Bytes&) const;
+
+    static Bytes toBytes(const boost::asio::ip::address&);
+
+private:
+    struct Node {
+        std::array<uint32_t, 2> children{0, 0};
+        bool terminal{false};
+    };
+    struct Trie {
+        // node 0 is the root, a child index of 0 means no child
+        std::vector<Node> nodes = std::vector<Node>(1);
+        std::size_t entries{0};
+        // set only for an empty configured list, never derived from how many entries parsed
+        bool allow_all{false};
+    };
+
+    static std::shared_ptr<const Trie> build(const std::vector<std::string>&);
+
+    std::atomic<std::shared_ptr<const Trie>> m_trie;
+};
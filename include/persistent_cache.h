@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+// Append-only store of cached answers in memory mapped segment files under one directory. Records carry a checksum
+// and a zlib compressed answer, the hash index is rebuilt by scanning the record headers at startup so a restarted
+// instance serves what it cached before. A background thread compresses and appends the queued answers, the only
+// writer of the files, and every COMPACTION_INTERVAL drops the index entries of expired records, rewrites the live
+// records of mostly dead segments into the active one and deletes them, and evicts the oldest segments while the
+// files take more than max_disk_bytes.
+class PersistentCache final {
+public:
+    struct Record {
+        std::string provider;
+        std::string answer;
+        std::chrono::system_clock::time_point expires_at;
+    };
+
+    // max_disk_bytes 0 is unbounded
+    PersistentCache(std::string /* dir */, std::size_t /* segment_size */, std::size_t /* max_disk_bytes */);
+    ~PersistentCache();
+
+    // false when the directory can't be used
+    bool open();
+
+    std::optional<Record> get(const std::string& /* key */);
+    // only queues the answer, dropped when MAX_PENDING_WRITES are queued already
+    void put(std::string /* key */, std::string /* provider */, std::shared_ptr<const std::string> /* answer */,
+             std::chrono::system_clock::time_point /* expires_at */);
+
+    nlohmann::json metrics();
+
+private:
+    struct Segment {
+        Segment(uint32_t, int, const char*, std::size_t);
+        ~Segment();
+
+        uint32_t id;
+        int fd;
+        const char* data;
+        std::size_t size;
+        // everything up to tail is written, bytes of records the index still points at are live
+        std::size_t tail{0};
+        std::size_t live{0};
+    };
+
+    struct Location {
+        uint32_t segment;
+        uint32_t offset;
+    };
+
+    struct Write {
+        std::string key;
+        std::string provider;
+        std::shared_ptr<const std::string> answer;
+        std::chrono::system_clock::time_point expires_at;
+    };
+
+    static constexpr auto COMPACTION_INTERVAL = std::chrono::seconds(60);
+    static constexpr std::size_t MAX_PENDING_WRITES{1024};
+
+    std::string path(uint32_t /* segment */) const;
+    std::shared_ptr<Segment> map(uint32_t /* segment */, bool /* create */);
+    void scan(Segment&);
+    // background thread only: appends an encoded record to the active segment, m_mtx is only taken to publish a new
+    // segment and the tail, never around the write
+    std::optional<Location> append(std::string_view /* record */);
+    void write(const Write&);
+    void forget(uint64_t /* hash */);
+    // m_mtx held, true while the index still points at this record
+    bool indexed(uint64_t /* hash */, uint32_t /* segment */, std::size_t /* offset */) const;
+    // key hashes and offsets of the records of a sealed segment, from the headers alone
+    std::vector<std::pair<uint64_t, uint32_t>> records(const Segment&, bool /* expired_only */) const;
+    void expire(const Segment&);
+    void evict();
+    void compact(std::stop_token);
+    void run(std::stop_token);
+
+    std::string m_dir;
+    std::size_t m_segment_size;
+    std::size_t m_max_disk_bytes;
+
+    std::mutex m_mtx;
+    std::map<uint32_t, std::shared_ptr<Segment>> m_segments;
+    std::unordered_map<uint64_t, Location> m_index;
+    std::atomic<uint64_t> m_compactions{0};
+    std::atomic<uint64_t> m_expirations{0};
+    std::atomic<uint64_t> m_evictions{0};
+    std::atomic<uint64_t> m_hits{0};
+    std::atomic<uint64_t> m_dropped_writes{0};
+
+    std::mutex m_queue_mtx;
+    std::vector<Write> m_queue;
+    std::condition_variable_any m_cv;
+    std::jthread m_writer;
+};
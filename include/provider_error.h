@@ -0,0 +1,130 @@
+#pragma once
+
+#include <charconv>
+#include <chrono>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include <boost/system/error_code.hpp>
+
+// A provider reports a failure by sending one of these through its channel, the string carries the detail shown to
+// the user. Everything sent with a default constructed error_code is answer text.
+enum class ProviderErrc {
+    // createHttpClient failed (dns, connect, proxy, tls)
+    ConnectFailed = 1,
+    // the request was sent but the transfer failed, curl errors included
+    RequestFailed,
+    // upstream answered with an unexpected http status
+    HttpStatus,
+    // upstream answered 200 with something we can't parse
+    BadResponse,
+    // cookies, secrets or quota needed before asking could not be obtained
+    Unavailable,
+    // connect, tls handshake or the response header took longer than allowed
+    Timeout,
+    // no token within the first token deadline, or the answer stopped mid-stream
+    Stalled,
+    // upstream answered 429, preceded by a ProviderHint::RetryAfter when it said when to come back
+    RateLimited,
+};
+
+template <>
+struct boost::system::is_error_code_enum<ProviderErrc> : std::true_type {};
+
+class ProviderCategory final : public boost::system::error_category {
+public:
+    const char* name() const noexcept override { return "provider"; }
+
+    std::string message(int ev) const override {
+        switch (static_cast<ProviderErrc>(ev)) {
+            case ProviderErrc::ConnectFailed:
+                return "connect failed";
+            case ProviderErrc::RequestFailed:
+                return "request failed";
+            case ProviderErrc::HttpStatus:
+                return "unexpected http status";
+            case ProviderErrc::BadResponse:
+                return "bad response";
+            case ProviderErrc::Unavailable:
+                return "unavailable";
+            case ProviderErrc::Timeout:
+                return "timeout";
+            case ProviderErrc::Stalled:
+                return "stalled";
+            case ProviderErrc::RateLimited:
+                return "rate limited";
+        }
+        return "unknown provider error";
+    }
+};
+
+inline const boost::system::error_category& providerCategory() {
+    static ProviderCategory category;
+    return category;
+}
+
+inline boost::system::error_code make_error_code(ProviderErrc e) {
+    return {static_cast<int>(e), providerCategory()};
+}
+
+inline bool isProviderError(const boost::system::error_code& ec) {
+    return ec.category() == providerCategory();
+}
+
+inline boost::system::error_code httpErrorCode(unsigned http_code) {
+    return make_error_code(http_code == 429 ? ProviderErrc::RateLimited : ProviderErrc::HttpStatus);
+}
+
+// Sent by a provider right before a RateLimited error when the upstream said when to come back, the message is the
+// delay in seconds. The pacing around every provider takes it out of the stream, it never reaches a client.
+enum class ProviderHint {
+    RetryAfter = 1,
+};
+
+template <>
+struct boost::system::is_error_code_enum<ProviderHint> : std::true_type {};
+
+class ProviderHintCategory final : public boost::system::error_category {
+public:
+    const char* name() const noexcept override { return "provider hint"; }
+
+    std::string message(int ev) const override {
+        switch (static_cast<ProviderHint>(ev)) {
+            case ProviderHint::RetryAfter:
+                return "retry after";
+        }
+        return "unknown provider hint";
+    }
+};
+
+inline const boost::system::error_category& providerHintCategory() {
+    static ProviderHintCategory category;
+    return category;
+}
+
+inline boost::system::error_code make_error_code(ProviderHint e) {
+    return {static_cast<int>(e), providerHintCategory()};
+}
+
+// only the delta seconds form of Retry-After is understood, a hint message has it too
+inline std::optional<std::chrono::seconds> parseRetryAfter(std::string_view retry_after) {
+    unsigned seconds{0};
+    auto [ptr, ec] = std::from_chars(retry_after.data(), retry_after.data() + retry_after.size(), seconds);
+    if (ec != std::errc{} || ptr == retry_after.data())
+        return std::nullopt;
+    return std::chrono::seconds(seconds);
+}
+
+// What a provider failed with before it got to answer, the detail is shown to the user as is.
+struct ProviderFailure {
+    boost::system::error_code ec;
+    std::string detail;
+    std::optional<std::chrono::seconds> retry_after;
+};
+
+inline ProviderFailure httpFailure(unsigned http_code, std::string detail, std::string_view retry_after) {
+    return {httpErrorCode(http_code), std::move(detail),
+            http_code == 429 ? parseRetryAfter(retry_after) : std::nullopt};
+}
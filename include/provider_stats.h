@@ -0,0 +1,39 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include <nlohmann/json.hpp>
+
+// Exponentially weighted per provider statistics, updated whenever a provider finishes a conversation.
+class ProviderStats final {
+public:
+    struct Snapshot {
+        double ttft_ms{0};
+        // tokens are estimated as 4 bytes of answer
+        double tokens_per_sec{0};
+        double success_rate{1};
+        uint64_t requests{0};
+        uint64_t failures{0};
+        // failures with ProviderErrc::Timeout or ProviderErrc::Stalled
+        uint64_t timeouts{0};
+    };
+
+    void recordSuccess(const std::string& /* provider */, std::chrono::milliseconds /* ttft */,
+                       double /* tokens_per_sec */);
+    void recordFailure(const std::string& /* provider */, bool /* timed_out */);
+
+    // std::nullopt until the provider finished a conversation
+    std::optional<Snapshot> get(const std::string& /* provider */);
+
+    nlohmann::json metrics();
+
+private:
+    static constexpr double ALPHA = 0.2;
+
+    std::mutex m_mtx;
+    std::unordered_map<std::string, Snapshot> m_snapshots;
+};
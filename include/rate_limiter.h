@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "cfg.h"
+
+// Token buckets keyed by remote ip and api key. Each bucket is a single atomic theoretical arrival time (GCRA), the
+// bucket maps are sharded so the accept path never serializes on one mutex, and idle buckets are dropped lazily.
+class RateLimiter final {
+public:
+    struct Decision {
+        bool allowed{true};
+        std::chrono::milliseconds retry_after{0};
+    };
+
+    explicit RateLimiter(const std::vector<RateLimitRule>&);
+
+    // ip is opaque (raw address bytes are fine), api_key may be empty
+    Decision check(std::string_view /* path */, std::string_view /* model */, std::string_view /* ip */,
+                   std::string_view /* api_key */);
+
+    nlohmann::json metrics() const;
+
+private:
+    struct StringHash {
+        using is_transparent = void;
+        std::size_t operator()(std::string_view str) const { return std::hash<std::string_view>{}(str); }
+    };
+    struct Bucket {
+        std::atomic<int64_t> tat{0};
+    };
+    using BucketMap = std::unordered_map<std::string, Bucket, StringHash, std::equal_to<>>;
+    struct alignas(64) Shard {
+        std::shared_mutex mtx;
+        // index 0 holds ip buckets, index 1 api key buckets
+        BucketMap buckets[2];
+        std::size_t sweep_threshold{1024};
+    };
+    struct Rule {
+        RateLimitRule cfg;
+        int64_t interval_ns;
+        int64_t burst_ns;
+        std::unique_ptr<Shard[]> shards;
+        std::atomic<uint64_t> allowed{0};
+        std::atomic<uint64_t> rejected{0};
+    };
+
+    Rule* match(std::string_view, std::string_view);
+    Decision consume(Rule&, std::size_t, std::string_view, int64_t);
+    // gives back the token consume took
+    void refund(Rule&, std::size_t, std::string_view);
+    static void sweep(BucketMap&, int64_t);
+
+    std::size_t m_shard_mask;
+    std::vector<std::unique_ptr<Rule>> m_rules;
+};
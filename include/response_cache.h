@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <nlohmann/json.hpp>
+
+#include "cfg.h"
+#include "persistent_cache.h"
+
+// LRU cache of completed answers keyed by conversationKey, bounded by max_bytes and ttl. Only models listed in the
+// config are cached, a hit is answered without touching the scheduler, the providers or the thread pool. With a
+// persist_dir every answer is written through to a PersistentCache as well, which serves the memory misses.
+class ResponseCache final {
+public:
+    struct Entry {
+        std::string provider;
+        std::shared_ptr<const std::string> answer;
+    };
+
+    explicit ResponseCache(const ResponseCacheConfig&);
+
+    bool enabled(const std::string& model) const { return m_models.contains(model); }
+
+    std::optional<Entry> get(const std::string& /* key */);
+    void put(const std::string& /* key */, std::string /* provider */, std::string /* answer */);
+
+    nlohmann::json metrics();
+
+private:
+    struct Item {
+        std::string key;
+        Entry entry;
+        std::chrono::steady_clock::time_point expires_at;
+        std::size_t bytes{0};
+    };
+
+    void erase(std::list<Item>::iterator);
+    // m_mtx held
+    void insert(const std::string& /* key */, Entry, std::chrono::steady_clock::time_point /* expires_at */);
+
+    ResponseCacheConfig m_cfg;
+    std::unordered_set<std::string> m_models;
+    std::unique_ptr<PersistentCache> m_store;
+
+    std::mutex m_mtx;
+    // most recently used first
+    std::list<Item> m_items;
+    std::unordered_map<std::string_view, std::list<Item>::iterator> m_index;
+    std::size_t m_bytes{0};
+    std::atomic<uint64_t> m_hits{0};
+    std::atomic<uint64_t> m_misses{0};
+    std::atomic<uint64_t> m_evictions{0};
+    std::atomic<uint64_t> m_expired{0};
+};
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include <boost/asio/awaitable.hpp>
+#include <nlohmann/json.hpp>
+
+#include "cfg.h"
+#include "helper.hpp"
+
+// Orders pending conversations before they reach a provider. Clients (remote ips) are served with deficit round
+// robin inside a lane, and the interactive lane is preferred over the batch lane.
+class FairScheduler final {
+public:
+    enum class Lane : uint8_t {
+        Interactive,
+        Batch,
+    };
+
+    // Holds one dispatch slot, the slot is handed to the next waiter on destruction.
+    class Ticket final {
+    public:
+        Ticket() = default;
+        Ticket(FairScheduler*, Lane);
+        Ticket(Ticket&&) noexcept;
+        Ticket& operator=(Ticket&&) noexcept;
+        Ticket(const Ticket&) = delete;
+        Ticket& operator=(const Ticket&) = delete;
+        ~Ticket();
+
+    private:
+        FairScheduler* m_scheduler{nullptr};
+        Lane m_lane{Lane::Interactive};
+    };
+
+    explicit FairScheduler(const SchedulerConfig&);
+
+    // std::nullopt means the request was rejected because the queue is full or it waited too long
+    boost::asio::awaitable<std::optional<Ticket>> acquire(std::string /* client */, Lane, std::size_t /* cost */ = 1);
+
+    nlohmann::json metrics();
+
+private:
+    struct Waiter {
+        std::shared_ptr<AsyncSignal> signal;
+        std::size_t cost{1};
+        std::chrono::steady_clock::time_point enqueue_time;
+        bool granted{false};
+    };
+    struct Flow {
+        std::deque<std::shared_ptr<Waiter>> waiters;
+        std::size_t deficit{0};
+    };
+    struct LaneState {
+        std::unordered_map<std::string, Flow> flows;
+        // clients with pending requests, in round robin order
+        std::deque<std::string> round;
+        std::size_t queued{0};
+        std::size_t running{0};
+        uint64_t dispatched{0};
+        uint64_t rejected{0};
+        uint64_t expired{0};
+        double wait_ms_avg{0};
+        double wait_ms_max{0};
+    };
+
+    void release(Lane);
+    void dispatchLocked();
+    std::shared_ptr<Waiter> popLocked(LaneState&);
+    void removeLocked(LaneState&, const std::string&, const std::shared_ptr<Waiter>&);
+    void recordWaitLocked(LaneState&, std::chrono::steady_clock::time_point);
+
+    const std::size_t m_capacity;
+    const std::size_t m_max_queued;
+    const std::size_t m_quantum;
+    const std::size_t m_batch_share;
+    const std::chrono::seconds m_queue_timeout;
+
+    std::mutex m_mtx;
+    std::array<LaneState, 2> m_lanes;
+    std::size_t m_running{0};
+    std::size_t m_interactive_streak{0};
+};
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <nlohmann/json.hpp>
+
+// Upstream sessions a provider prepared ahead of the conversations that use them, a connection with the
+// conversation already opened upstream. A conversation takes the newest session that is younger than max_age, each
+// taken session is replaced in the background. Sessions are used once.
+template <typename Session>
+class SessionPool final : public std::enable_shared_from_this<SessionPool<Session>> {
+public:
+    using Factory = std::function<boost::asio::awaitable<std::optional<Session>>()>;
+
+    SessionPool(boost::asio::any_io_executor executor, std::size_t size, std::chrono::seconds max_age, Factory factory)
+        : m_executor(std::move(executor)), m_size(size), m_max_age(max_age), m_factory(std::move(factory)) {}
+
+    // fills the pool in the background
+    void start() {
+        {
+            std::lock_guard lk(m_mtx);
+            if (m_filling || m_items.size() >= m_size)
+                return;
+            m_filling = true;
+        }
+        boost::asio::co_spawn(m_executor, fill(this->shared_from_this()), boost::asio::detached);
+    }
+
+    // std::nullopt when no fresh session is ready, the caller sets one up itself
+    std::optional<Session> take() {
+        std::optional<Session> session;
+        {
+            std::lock_guard lk(m_mtx);
+            purge();
+            if (!m_items.empty()) {
+                session.emplace(std::move(m_items.back().session));
+                m_items.pop_back();
+            }
+        }
+        (session ? m_hits : m_misses).fetch_add(1, std::memory_order_relaxed);
+        start();
+        return session;
+    }
+
+    nlohmann::json metrics() {
+        nlohmann::json metrics;
+        metrics["hits"] = m_hits.load(std::memory_order_relaxed);
+        metrics["misses"] = m_misses.load(std::memory_order_relaxed);
+        metrics["warmed"] = m_warmed.load(std::memory_order_relaxed);
+        metrics["expired"] = m_expired.load(std::memory_order_relaxed);
+        metrics["failures"] = m_failures.load(std::memory_order_relaxed);
+        std::lock_guard lk(m_mtx);
+        metrics["ready"] = m_items.size();
+        return metrics;
+    }
+
+private:
+    struct Item {
+        Session session;
+        std::chrono::steady_clock::time_point created_at;
+    };
+
+    // the pool keeps itself alive while it fills, a failed setup ends the round until the next take
+    static boost::asio::awaitable<void> fill(std::shared_ptr<SessionPool> self) {
+        while (true) {
+            std::optional<Session> session;
+            try {
+                session = co_await self->m_factory();
+            } catch (const std::exception&) {
+            }
+            std::lock_guard lk(self->m_mtx);
+            if (!session) {
+                self->m_failures.fetch_add(1, std::memory_order_relaxed);
+                self->m_filling = false;
+                co_return;
+            }
+            self->m_items.emplace_back(Item{std::move(session.value()), std::chrono::steady_clock::now()});
+            self->m_warmed.fetch_add(1, std::memory_order_relaxed);
+            self->purge();
+            if (self->m_items.size() >= self->m_size) {
+                self->m_filling = false;
+                co_return;
+            }
+        }
+    }
+
+    // drops sessions older than max_age, oldest first, m_mtx held
+    void purge() {
+        auto now = std::chrono::steady_clock::now();
+        while (!m_items.empty() && now - m_items.front().created_at >= m_max_age) {
+            m_items.pop_front();
+            m_expired.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    boost::asio::any_io_executor m_executor;
+    std::size_t m_size;
+    std::chrono::seconds m_max_age;
+    Factory m_factory;
+
+    std::mutex m_mtx;
+    // newest last
+    std::deque<Item> m_items;
+    bool m_filling{false};
+    std::atomic<uint64_t> m_hits{0};
+    std::atomic<uint64_t> m_misses{0};
+    std::atomic<uint64_t> m_warmed{0};
+    std::atomic<uint64_t> m_expired{0};
+    std::atomic<uint64_t> m_failures{0};
+};
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <functional>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/intrusive/list.hpp>
+
+// Hierarchical timing wheel, one per io_context (boost::asio::use_service<TimerWheel>(context)). A Deadline costs no
+// allocation to re-arm and no timer of its own, the whole wheel is driven by a single steady_timer that only ticks
+// while deadlines are armed. Everything here must be used from the thread running the owning io_context.
+class TimerWheel final : public boost::asio::execution_context::service {
+    using Hook = boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::auto_unlink>>;
+
+public:
+    using Clock = std::chrono::steady_clock;
+    static constexpr auto TICK = std::chrono::milliseconds(100);
+
+    class Deadline final : public Hook {
+    public:
+        Deadline(TimerWheel&, std::function<void()> /* on_expire */);
+        Deadline(const Deadline&) = delete;
+        Deadline& operator=(const Deadline&) = delete;
+        ~Deadline();
+
+        // re-arming replaces the previous expiry
+        void expiresAfter(Clock::duration);
+        void cancel();
+
+    private:
+        friend class TimerWheel;
+
+        TimerWheel& m_wheel;
+        std::function<void()> m_on_expire;
+        uint64_t m_expiry_tick{0};
+    };
+
+    static inline boost::asio::execution_context::id id;
+
+    explicit TimerWheel(boost::asio::io_context&);
+
+private:
+    static constexpr std::size_t SLOT_BITS = 6;
+    static constexpr std::size_t SLOTS = 1 << SLOT_BITS;
+    // 100ms * 64^4, about 19 days
+    static constexpr std::size_t LEVELS = 4;
+
+    using Slot = boost::intrusive::list<Deadline, boost::intrusive::constant_time_size<false>>;
+
+    void shutdown() override;
+    uint64_t toTick(Clock::time_point) const;
+    void insert(Deadline&);
+    void step();
+    void onTick();
+    void scheduleTick();
+
+    std::array<std::array<Slot, SLOTS>, LEVELS> m_slots;
+    boost::asio::steady_timer m_timer;
+    Clock::time_point m_start;
+    uint64_t m_current_tick{0};
+    std::size_t m_armed{0};
+    bool m_ticking{false};
+};
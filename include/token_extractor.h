@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Fields scraped out of a page while it downloads. A field is the text between a literal marker and a terminator
+// byte, fields are looked for in the order they appear on the page and a marker may straddle the pieces the page
+// arrives in. A TokenPattern is compiled once per provider, a TokenExtractor follows one download and tells when the
+// rest of the page is no longer needed.
+class TokenPattern final {
+public:
+    struct Field {
+        std::string marker;
+        char terminator;
+    };
+
+    // markers must not be empty
+    explicit TokenPattern(std::vector<Field>);
+
+private:
+    friend class TokenExtractor;
+
+    struct Matcher {
+        std::string marker;
+        char terminator;
+        // length of the longest proper prefix of marker[0..i] that is also its suffix
+        std::vector<std::size_t> fallback;
+    };
+
+    std::vector<Matcher> m_matchers;
+};
+
+class TokenExtractor final {
+public:
+    // a value longer than this is not a token, the marker is looked for again after it
+    static constexpr std::size_t max_value_size = 4096;
+
+    explicit TokenExtractor(const TokenPattern&);
+
+    // scans the next piece of the page, true once every field is found
+    bool feed(std::string_view);
+    bool done() const { return m_field == m_pattern.m_matchers.size(); }
+    // one per field in the order of the pattern, complete once done()
+    std::vector<std::string>& values() { return m_values; }
+
+private:
+    const TokenPattern& m_pattern;
+    std::size_t m_field{0};
+    // bytes of the marker of the current field matched so far
+    std::size_t m_matched{0};
+    bool m_capturing{false};
+    std::vector<std::string> m_values;
+};
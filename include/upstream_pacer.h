@@ -0,0 +1,51 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include <boost/asio/awaitable.hpp>
+#include <nlohmann/json.hpp>
+
+#include "cfg.h"
+
+// Learns how fast an upstream may be asked from its 429 answers. A provider is not paced until it answers 429, then
+// its requests are spread evenly at half the rate it was asked at (and held back for Retry-After), every success
+// raises the rate again until it is fast enough to stop pacing. Requests wait for their slot for at most max_wait.
+class UpstreamPacer final {
+public:
+    explicit UpstreamPacer(const PacingConfig&);
+
+    // waits for the next slot of the provider, false when that is more than max_wait away
+    boost::asio::awaitable<bool> acquire(const std::string& /* provider */);
+
+    void onRateLimited(const std::string& /* provider */, std::optional<std::chrono::seconds> /* retry_after */);
+    void onSuccess(const std::string& /* provider */);
+
+    nlohmann::json metrics();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr auto RATE_WINDOW = std::chrono::seconds(10);
+
+    struct Pace {
+        // requests per second, std::nullopt while the provider is not paced
+        std::optional<double> rate;
+        Clock::time_point next_slot;
+        Clock::time_point limited_at;
+        // arrivals of the current window, the rate a provider was asked at when it first answered 429
+        Clock::time_point window_start;
+        uint64_t window_requests{0};
+        double arrival_rate{0};
+        uint64_t rate_limited{0};
+        uint64_t delayed{0};
+        uint64_t rejected{0};
+    };
+
+    PacingConfig m_cfg;
+    std::mutex m_mtx;
+    std::unordered_map<std::string, Pace> m_paces;
+};
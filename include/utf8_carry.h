@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+// Repairs the UTF-8 of one answer stream. Providers forward network chunks as they arrive, a character split across
+// two of them would reach the client as two broken halves: the incomplete sequence a chunk ends with is held back and
+// put in front of the next chunk. Bytes that are not UTF-8 at all are replaced by U+FFFD. Chunks of plain ASCII,
+// most of them, are checked eight bytes at a time and passed through untouched.
+class Utf8Carry final {
+public:
+    // the bytes held back so far plus the chunk, up to the last complete character
+    std::string feed(std::string /* chunk */);
+    // what is still held back when the stream ends, never a complete character
+    std::string flush();
+
+private:
+    static bool isAscii(std::string_view);
+
+    std::string m_carry;
+};
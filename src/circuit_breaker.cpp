@@ -0,0 +1,145 @@
+#include <algorithm>
+
+#include <spdlog/spdlog.h>
+
+#include "circuit_breaker.h"
+
+CircuitBreaker::CircuitBreaker(const CircuitBreakerConfig& cfg) : m_cfg(cfg) {
+    m_cfg.window = std::max<std::size_t>(m_cfg.window, 1);
+    m_cfg.min_calls = std::clamp<std::size_t>(m_cfg.min_calls, 1, m_cfg.window);
+    m_cfg.half_open_probes = std::max<std::size_t>(m_cfg.half_open_probes, 1);
+}
+
+std::optional<CircuitBreaker::Permit> CircuitBreaker::tryAcquire(const std::string& provider) {
+    std::lock_guard lk(m_mtx);
+    auto& breaker = m_breakers[provider];
+    if (breaker.state == State::Open) {
+        if (std::chrono::steady_clock::now() - breaker.opened_at < std::chrono::seconds(m_cfg.open_duration)) {
+            ++breaker.rejected;
+            return std::nullopt;
+        }
+        transition(breaker, provider, State::HalfOpen);
+    }
+    if (breaker.state == State::HalfOpen) {
+        if (breaker.probes_running + breaker.probes_succeeded >= m_cfg.half_open_probes) {
+            ++breaker.rejected;
+            return std::nullopt;
+        }
+        ++breaker.probes_running;
+    }
+    return Permit{provider, breaker.generation};
+}
+
+void CircuitBreaker::onSuccess(const Permit& permit, std::chrono::milliseconds ttft) {
+    std::lock_guard lk(m_mtx);
+    auto breaker = current(permit);
+    if (!breaker)
+        return;
+    auto slow = ttft >= std::chrono::milliseconds(m_cfg.slow_call_threshold);
+    if (breaker->state == State::HalfOpen) {
+        --breaker->probes_running;
+        if (slow) {
+            transition(*breaker, permit.provider, State::Open);
+        } else if (++breaker->probes_succeeded >= m_cfg.half_open_probes) {
+            transition(*breaker, permit.provider, State::Closed);
+        }
+        return;
+    }
+    record(*breaker, permit.provider, slow ? Slow : Succeeded);
+}
+
+void CircuitBreaker::onFailure(const Permit& permit) {
+    std::lock_guard lk(m_mtx);
+    auto breaker = current(permit);
+    if (!breaker)
+        return;
+    if (breaker->state == State::HalfOpen) {
+        transition(*breaker, permit.provider, State::Open);
+        return;
+    }
+    record(*breaker, permit.provider, Failed);
+}
+
+void CircuitBreaker::onAbandoned(const Permit& permit) {
+    std::lock_guard lk(m_mtx);
+    if (auto breaker = current(permit); breaker && breaker->state == State::HalfOpen)
+        --breaker->probes_running;
+}
+
+bool CircuitBreaker::available(const std::string& provider) {
+    std::lock_guard lk(m_mtx);
+    auto it = m_breakers.find(provider);
+    if (it == m_breakers.end() || it->second.state != State::Open)
+        return true;
+    // due for probing, the next conversation moves it to half-open
+    return std::chrono::steady_clock::now() - it->second.opened_at >= std::chrono::seconds(m_cfg.open_duration);
+}
+
+nlohmann::json CircuitBreaker::metrics() {
+    std::lock_guard lk(m_mtx);
+    nlohmann::json metrics = nlohmann::json::object();
+    for (auto& [provider, breaker] : m_breakers) {
+        auto failed = std::ranges::count_if(breaker.outcomes, [](auto outcome) { return outcome == Failed; });
+        auto slow = std::ranges::count_if(breaker.outcomes, [](auto outcome) { return outcome == Slow; });
+        metrics[provider] = {
+            {"state", stateName(breaker.state)},
+            {"calls", breaker.outcomes.size()},
+            {"failed", failed},
+            {"slow", slow},
+            {"opened", breaker.opened},
+            {"rejected", breaker.rejected},
+        };
+    }
+    return metrics;
+}
+
+std::string_view CircuitBreaker::stateName(State state) {
+    switch (state) {
+        case State::Closed:
+            return "closed";
+        case State::Open:
+            return "open";
+        case State::HalfOpen:
+            return "half-open";
+    }
+    return "unknown";
+}
+
+CircuitBreaker::Breaker* CircuitBreaker::current(const Permit& permit) {
+    auto it = m_breakers.find(permit.provider);
+    if (it == m_breakers.end() || it->second.generation != permit.generation)
+        return nullptr;
+    return &it->second;
+}
+
+void CircuitBreaker::record(Breaker& breaker, const std::string& provider, uint8_t outcome) {
+    if (breaker.outcomes.size() < m_cfg.window) {
+        breaker.outcomes.emplace_back(outcome);
+    } else {
+        breaker.outcomes[breaker.next] = outcome;
+        breaker.next = (breaker.next + 1) % m_cfg.window;
+    }
+    if (breaker.outcomes.size() < m_cfg.min_calls)
+        return;
+    auto calls = static_cast<double>(breaker.outcomes.size());
+    auto failed = std::ranges::count_if(breaker.outcomes, [](auto item) { return item == Failed; });
+    auto slow = std::ranges::count_if(breaker.outcomes, [](auto item) { return item == Slow; });
+    if (failed / calls >= m_cfg.failure_rate || slow / calls >= m_cfg.slow_call_rate) {
+        SPDLOG_WARN("[{}] {} of {} conversations failed, {} slow", provider, failed, breaker.outcomes.size(), slow);
+        transition(breaker, provider, State::Open);
+    }
+}
+
+void CircuitBreaker::transition(Breaker& breaker, const std::string& provider, State state) {
+    SPDLOG_INFO("[{}] circuit breaker {} -> {}", provider, stateName(breaker.state), stateName(state));
+    breaker.state = state;
+    ++breaker.generation;
+    breaker.outcomes.clear();
+    breaker.next = 0;
+    breaker.probes_running = 0;
+    breaker.probes_succeeded = 0;
+    if (state == State::Open) {
+        breaker.opened_at = std::chrono::steady_clock::now();
+        ++breaker.opened;
+    }
+}
@@ -0,0 +1,134 @@
+#include <functional>
+
+#include <spdlog/spdlog.h>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+
+#include "coalescer.h"
+
+Coalescer::Coalescer(const CoalescingConfig& cfg) : m_cfg(cfg) {}
+
+boost::asio::awaitable<void> Coalescer::run(const std::string& model, const GptCallback& func,
+                                            std::shared_ptr<FreeGpt::Channel> ch, nlohmann::json json) {
+    auto normalized = m_cfg.enable ? conversationKey(model, json) : std::nullopt;
+    if (!normalized) {
+        co_await func(std::move(ch), std::move(json));
+        co_return;
+    }
+    auto hash = std::hash<std::string>{}(normalized.value());
+    std::shared_ptr<Flight> flight;
+    bool leader{false};
+    {
+        std::lock_guard lk(m_mtx);
+        if (auto it = m_flights.find(hash); it == m_flights.end()) {
+            flight = std::make_shared<Flight>();
+            flight->hash = hash;
+            flight->key = std::move(normalized.value());
+            m_flights.emplace(hash, flight);
+            leader = true;
+        } else if (it->second->key == normalized.value()) {
+            std::lock_guard flight_lk(it->second->mtx);
+            if (!it->second->done && it->second->bytes <= m_cfg.max_replay_bytes) {
+                flight = it->second;
+                ++flight->subscribers;
+            }
+        }
+    }
+    // a hash collision or an answer too long to replay, this one goes upstream on its own
+    if (!flight) {
+        co_await func(std::move(ch), std::move(json));
+        co_return;
+    }
+    if (leader) {
+        m_started.fetch_add(1, std::memory_order_relaxed);
+        auto executor = co_await boost::asio::this_coro::executor;
+        flight->upstream = spawnProvider(executor, func, std::move(json));
+        boost::asio::co_spawn(executor, relay(flight), boost::asio::detached);
+    } else {
+        m_joined.fetch_add(1, std::memory_order_relaxed);
+        SPDLOG_INFO("[{}] join the identical conversation in flight", model);
+    }
+    co_await subscribe(std::move(flight), std::move(ch));
+}
+
+nlohmann::json Coalescer::metrics() {
+    nlohmann::json metrics;
+    metrics["started"] = m_started.load(std::memory_order_relaxed);
+    metrics["joined"] = m_joined.load(std::memory_order_relaxed);
+    std::lock_guard lk(m_mtx);
+    metrics["in_flight"] = m_flights.size();
+    return metrics;
+}
+
+boost::asio::awaitable<void> Coalescer::relay(std::shared_ptr<Flight> flight) {
+    while (true) {
+        auto [ec, str] = co_await flight->upstream->async_receive(use_nothrow_awaitable);
+        if (ec && !isProviderError(ec) && !isServedBy(ec))
+            break;
+        std::vector<std::shared_ptr<AsyncSignal>> waiters;
+        {
+            std::lock_guard lk(flight->mtx);
+            flight->bytes += str.size();
+            flight->messages.emplace_back(ec, std::move(str));
+            waiters.swap(flight->waiters);
+        }
+        for (auto& waiter : waiters)
+            waiter->notify();
+    }
+    std::vector<std::shared_ptr<AsyncSignal>> waiters;
+    {
+        std::lock_guard lk(m_mtx);
+        if (auto it = m_flights.find(flight->hash); it != m_flights.end() && it->second == flight)
+            m_flights.erase(it);
+        std::lock_guard flight_lk(flight->mtx);
+        flight->done = true;
+        waiters.swap(flight->waiters);
+    }
+    for (auto& waiter : waiters)
+        waiter->notify();
+}
+
+boost::asio::awaitable<void> Coalescer::subscribe(std::shared_ptr<Flight> flight,
+                                                  std::shared_ptr<FreeGpt::Channel> ch) {
+    ScopeExit auto_exit{[&] { ch->close(); }};
+    auto executor = co_await boost::asio::this_coro::executor;
+    std::size_t next{0};
+    while (true) {
+        std::vector<std::pair<boost::system::error_code, std::string>> messages;
+        std::shared_ptr<AsyncSignal> signal;
+        {
+            std::lock_guard lk(flight->mtx);
+            if (next < flight->messages.size()) {
+                messages.assign(flight->messages.begin() + next, flight->messages.end());
+                next = flight->messages.size();
+            } else if (flight->done) {
+                break;
+            } else {
+                signal = std::make_shared<AsyncSignal>(executor);
+                flight->waiters.emplace_back(signal);
+            }
+        }
+        if (signal) {
+            co_await signal->wait();
+            continue;
+        }
+        for (auto& [ec, str] : messages) {
+            if (auto [send_ec] = co_await ch->async_send(ec, std::move(str), use_nothrow_awaitable); send_ec) {
+                leave(flight);
+                co_return;
+            }
+        }
+    }
+    leave(flight);
+}
+
+void Coalescer::leave(const std::shared_ptr<Flight>& flight) {
+    std::lock_guard lk(m_mtx);
+    std::lock_guard flight_lk(flight->mtx);
+    if (--flight->subscribers != 0 || flight->done)
+        return;
+    // nobody listens anymore, a later identical conversation starts afresh
+    if (auto it = m_flights.find(flight->hash); it != m_flights.end() && it->second == flight)
+        m_flights.erase(it);
+    flight->upstream->close();
+}
@@ -0,0 +1,156 @@
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <utility>
+
+#include <spdlog/spdlog.h>
+#include <boost/asio/as_tuple.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/use_awaitable.hpp>
+
+#include "connection_governor.h"
+
+namespace {
+
+// listen socket, epoll and eventfds of every io_context, log files, curl resolver threads and the like
+constexpr rlim_t RESERVED_FDS = 64;
+// the client socket plus the upstream socket of the provider serving it
+constexpr rlim_t FDS_PER_CONNECTION = 2;
+
+constexpr std::string_view REJECT_RESPONSE{
+    "HTTP/1.1 503 Service Unavailable\r\nConnection: close\r\nContent-Length: 0\r\n\r\n"};
+
+std::size_t fdBudget() {
+    rlimit limit{};
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+        SPDLOG_ERROR("getrlimit: {}", strerror(errno));
+        return std::numeric_limits<std::size_t>::max();
+    }
+    if (limit.rlim_cur < limit.rlim_max) {
+        auto raised = limit;
+        raised.rlim_cur = limit.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &raised) == 0)
+            limit = raised;
+    }
+    if (limit.rlim_cur == RLIM_INFINITY)
+        return std::numeric_limits<std::size_t>::max();
+    if (limit.rlim_cur <= RESERVED_FDS + FDS_PER_CONNECTION)
+        return 1;
+    return (limit.rlim_cur - RESERVED_FDS) / FDS_PER_CONNECTION;
+}
+
+}  // namespace
+
+ConnectionGovernor::Lease::Lease(ConnectionGovernor* governor) : m_governor(governor) {}
+
+ConnectionGovernor::Lease::Lease(Lease&& other) noexcept : m_governor(std::exchange(other.m_governor, nullptr)) {}
+
+ConnectionGovernor::Lease& ConnectionGovernor::Lease::operator=(Lease&& other) noexcept {
+    if (this != &other) {
+        if (m_governor)
+            m_governor->release();
+        m_governor = std::exchange(other.m_governor, nullptr);
+    }
+    return *this;
+}
+
+ConnectionGovernor::Lease::~Lease() {
+    if (m_governor)
+        m_governor->release();
+}
+
+ConnectionGovernor::ConnectionGovernor(const ConnectionConfig& cfg)
+    : m_limit(fdBudget()), m_spare_fd(::open("/dev/null", O_RDONLY | O_CLOEXEC)) {
+    if (cfg.max_connections != 0)
+        m_limit = std::min(m_limit, cfg.max_connections);
+    if (m_spare_fd < 0)
+        SPDLOG_ERROR("open spare fd: {}", strerror(errno));
+    SPDLOG_INFO("connection budget: {}", m_limit);
+}
+
+ConnectionGovernor::~ConnectionGovernor() {
+    if (m_spare_fd >= 0)
+        ::close(m_spare_fd);
+}
+
+boost::asio::awaitable<ConnectionGovernor::Lease> ConnectionGovernor::acquire() {
+    auto executor = co_await boost::asio::this_coro::executor;
+    bool queued = false;
+    while (true) {
+        std::shared_ptr<AsyncSignal> signal;
+        {
+            std::lock_guard lk(m_mtx);
+            if (m_active.load(std::memory_order_relaxed) < m_limit) {
+                m_active.fetch_add(1, std::memory_order_relaxed);
+                co_return Lease{this};
+            }
+            signal = std::make_shared<AsyncSignal>(executor);
+            m_waiter = signal;
+        }
+        if (!std::exchange(queued, true)) {
+            m_queued.fetch_add(1, std::memory_order_relaxed);
+            SPDLOG_WARN("connection budget {} is used up, pause accepting", m_limit);
+        }
+        co_await signal->wait();
+    }
+}
+
+boost::asio::awaitable<bool> ConnectionGovernor::onAcceptError(boost::asio::ip::tcp::acceptor& acceptor,
+                                                               const boost::system::error_code& ec) {
+    if (ec == boost::asio::error::operation_aborted || !acceptor.is_open())
+        co_return false;
+    m_accept_errors.fetch_add(1, std::memory_order_relaxed);
+    if (ec == boost::asio::error::no_descriptors || ec == boost::system::errc::too_many_files_open_in_system)
+        rejectWithSpareFd(acceptor);
+    // the error usually persists for a while (fd or memory exhaustion), retrying at once would spin
+    m_backoff = m_backoff.count() == 0 ? MIN_BACKOFF : std::min(m_backoff * 2, MAX_BACKOFF);
+    SPDLOG_ERROR("Accept failed, error: {}, retry in {}ms", ec.message(), m_backoff.count());
+    boost::asio::steady_timer timer(co_await boost::asio::this_coro::executor, m_backoff);
+    [[maybe_unused]] auto [timer_ec] = co_await timer.async_wait(boost::asio::as_tuple(boost::asio::use_awaitable));
+    co_return acceptor.is_open();
+}
+
+void ConnectionGovernor::onAccepted() {
+    m_backoff = std::chrono::milliseconds(0);
+    m_accepted.fetch_add(1, std::memory_order_relaxed);
+}
+
+nlohmann::json ConnectionGovernor::metrics() {
+    nlohmann::json metrics;
+    metrics["active"] = active();
+    metrics["limit"] = m_limit;
+    metrics["accepted"] = m_accepted.load(std::memory_order_relaxed);
+    metrics["queued"] = m_queued.load(std::memory_order_relaxed);
+    metrics["rejected"] = m_rejected.load(std::memory_order_relaxed);
+    metrics["accept_errors"] = m_accept_errors.load(std::memory_order_relaxed);
+    {
+        std::lock_guard lk(m_mtx);
+        metrics["accept_paused"] = m_waiter != nullptr;
+    }
+    return metrics;
+}
+
+void ConnectionGovernor::release() {
+    m_active.fetch_sub(1, std::memory_order_relaxed);
+    std::lock_guard lk(m_mtx);
+    if (m_waiter)
+        std::exchange(m_waiter, nullptr)->notify();
+}
+
+void ConnectionGovernor::rejectWithSpareFd(boost::asio::ip::tcp::acceptor& acceptor) {
+    if (m_spare_fd < 0)
+        return;
+    // give the spare fd up for a moment so the pending client gets an answer instead of a hanging connect
+    ::close(m_spare_fd);
+    if (int fd = ::accept4(acceptor.native_handle(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC); fd >= 0) {
+        [[maybe_unused]] auto n = ::send(fd, REJECT_RESPONSE.data(), REJECT_RESPONSE.size(), MSG_NOSIGNAL);
+        ::close(fd);
+        m_rejected.fetch_add(1, std::memory_order_relaxed);
+    }
+    m_spare_fd = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
@@ -0,0 +1,107 @@
+#include "conversation_sessions.h"
+
+ConversationSessions::ConversationSessions(const ConversationSessionConfig& cfg) : m_cfg(cfg) {}
+
+std::optional<nlohmann::json> ConversationSessions::find(const std::string& provider, const nlohmann::json& request) {
+    auto key_opt = key(provider, request);
+    if (!key_opt)
+        return std::nullopt;
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard lk(m_mtx);
+    evict();
+    auto it = m_index.find(key_opt.value());
+    if (it == m_index.end() || it->second->history != history(request)) {
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+        return std::nullopt;
+    }
+    it->second->expires_at = now + std::chrono::seconds(m_cfg.ttl);
+    m_items.splice(m_items.begin(), m_items, it->second);
+    m_hits.fetch_add(1, std::memory_order_relaxed);
+    return it->second->state;
+}
+
+void ConversationSessions::store(const std::string& provider, const nlohmann::json& request, nlohmann::json state) {
+    auto key_opt = key(provider, request);
+    if (!key_opt)
+        return;
+    // the client appends this turn's question and answer to the history it sends next
+    auto next_history = history(request) + 2;
+    auto expires_at = std::chrono::steady_clock::now() + std::chrono::seconds(m_cfg.ttl);
+    std::lock_guard lk(m_mtx);
+    if (auto it = m_index.find(key_opt.value()); it != m_index.end()) {
+        it->second->state = std::move(state);
+        it->second->history = next_history;
+        it->second->expires_at = expires_at;
+        m_items.splice(m_items.begin(), m_items, it->second);
+        return;
+    }
+    m_items.emplace_front(Item{
+        .key = std::move(key_opt.value()),
+        .state = std::move(state),
+        .history = next_history,
+        .expires_at = expires_at,
+    });
+    m_index.emplace(m_items.front().key, m_items.begin());
+    evict();
+}
+
+void ConversationSessions::erase(const std::string& provider, const nlohmann::json& request) {
+    auto key_opt = key(provider, request);
+    if (!key_opt)
+        return;
+    std::lock_guard lk(m_mtx);
+    if (auto it = m_index.find(key_opt.value()); it != m_index.end()) {
+        auto item = it->second;
+        m_index.erase(it);
+        m_items.erase(item);
+    }
+}
+
+nlohmann::json ConversationSessions::metrics() {
+    nlohmann::json metrics;
+    metrics["hits"] = m_hits.load(std::memory_order_relaxed);
+    metrics["misses"] = m_misses.load(std::memory_order_relaxed);
+    metrics["evictions"] = m_evictions.load(std::memory_order_relaxed);
+    std::lock_guard lk(m_mtx);
+    metrics["entries"] = m_items.size();
+    return metrics;
+}
+
+std::optional<std::string> ConversationSessions::key(const std::string& provider, const nlohmann::json& request) {
+    auto non_empty = [&](const char* field) -> const std::string* {
+        auto it = request.find(field);
+        if (it == request.end() || !it->is_string() || it->get_ref<const std::string&>().empty())
+            return nullptr;
+        return &it->get_ref<const std::string&>();
+    };
+    auto client = non_empty("client");
+    auto conversation_id = non_empty("conversation_id");
+    if (!client || !conversation_id)
+        return std::nullopt;
+    std::string key{provider};
+    key.push_back('\0');
+    key.append(*client);
+    key.push_back('\0');
+    key.append(*conversation_id);
+    return key;
+}
+
+std::size_t ConversationSessions::history(const nlohmann::json& request) {
+    auto meta = request.find("meta");
+    if (meta == request.end() || !meta->is_object() || !meta->contains("content"))
+        return 0;
+    auto& content = meta->at("content");
+    auto conversation = content.find("conversation");
+    if (conversation == content.end() || !conversation->is_array())
+        return 0;
+    return conversation->size();
+}
+
+void ConversationSessions::evict() {
+    auto now = std::chrono::steady_clock::now();
+    while (!m_items.empty() && (m_items.back().expires_at <= now || m_items.size() > m_cfg.max_entries)) {
+        m_index.erase(m_items.back().key);
+        m_items.pop_back();
+        m_evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <exception>
+#include <format>
+#include <thread>
+
+#include <spdlog/spdlog.h>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/this_coro.hpp>
+
+#include "credential_cache.h"
+#include "provider_error.h"
+
+CredentialCache::CredentialCache(const CredentialCacheConfig& cfg)
+    : m_cfg(cfg), m_shard_num(std::max(std::thread::hardware_concurrency(), 1u)) {}
+
+void CredentialCache::add(std::string name, std::chrono::seconds ttl) {
+    auto slot = std::make_unique<Slot>();
+    slot->ttl = ttl;
+    slot->shards = std::make_unique<Shard[]>(m_shard_num);
+    m_slots.insert_or_assign(std::move(name), std::move(slot));
+}
+
+boost::asio::awaitable<CredentialCache::Result> CredentialCache::get(const std::string& name, Fetcher fetcher) {
+    auto it = m_slots.find(name);
+    if (!m_cfg.enable || it == m_slots.end())
+        co_return co_await fetcher();
+    auto& slot = *it->second;
+    auto executor = co_await boost::asio::this_coro::executor;
+    auto now = std::chrono::steady_clock::now();
+    if (auto credential = load(slot); credential && credential->expires_at > now) {
+        slot.hits.fetch_add(1, std::memory_order_relaxed);
+        if (credential->refresh_at <= now) {
+            std::unique_lock lk(slot.mtx);
+            if (!slot.fetching) {
+                slot.fetching = true;
+                lk.unlock();
+                slot.refreshes.fetch_add(1, std::memory_order_relaxed);
+                boost::asio::co_spawn(executor, fetch(slot, std::move(fetcher)), boost::asio::detached);
+            }
+        }
+        co_return credential->value;
+    }
+    slot.misses.fetch_add(1, std::memory_order_relaxed);
+    std::unique_lock lk(slot.mtx);
+    // a fetch may have published while the lock was taken
+    if (auto credential = load(slot); credential && credential->expires_at > now)
+        co_return credential->value;
+    if (!slot.fetching) {
+        slot.fetching = true;
+        lk.unlock();
+        co_return co_await fetch(slot, std::move(fetcher));
+    }
+    auto signal = std::make_shared<AsyncSignal>(executor);
+    slot.waiters.emplace_back(signal);
+    lk.unlock();
+    co_await signal->wait();
+    if (auto credential = load(slot); credential && credential->expires_at > std::chrono::steady_clock::now())
+        co_return credential->value;
+    lk.lock();
+    co_return std::unexpected(slot.failure.value_or(ProviderFailure{
+        make_error_code(ProviderErrc::Unavailable), std::format("can't get credential {}", name), {}}));
+}
+
+void CredentialCache::invalidate(const std::string& name, const std::string& value) {
+    auto it = m_slots.find(name);
+    if (it == m_slots.end())
+        return;
+    auto& slot = *it->second;
+    std::lock_guard lk(slot.mtx);
+    if (auto credential = load(slot); credential && credential->value == value)
+        publish(slot, nullptr);
+}
+
+nlohmann::json CredentialCache::metrics() {
+    nlohmann::json metrics = nlohmann::json::object();
+    auto now = std::chrono::steady_clock::now();
+    for (auto& [name, slot] : m_slots) {
+        nlohmann::json item;
+        item["hits"] = slot->hits.load(std::memory_order_relaxed);
+        item["misses"] = slot->misses.load(std::memory_order_relaxed);
+        item["refreshes"] = slot->refreshes.load(std::memory_order_relaxed);
+        item["failures"] = slot->failures.load(std::memory_order_relaxed);
+        auto credential = load(*slot);
+        item["cached"] = credential && credential->expires_at > now;
+        if (credential)
+            item["age"] = std::chrono::duration_cast<std::chrono::seconds>(now - credential->fetched_at).count();
+        metrics[name] = std::move(item);
+    }
+    return metrics;
+}
+
+std::shared_ptr<const CredentialCache::Credential> CredentialCache::load(Slot& slot) const {
+    static thread_local const std::size_t thread_hash = std::hash<std::thread::id>{}(std::this_thread::get_id());
+    return slot.shards[thread_hash % m_shard_num].credential.load(std::memory_order_acquire);
+}
+
+boost::asio::awaitable<CredentialCache::Result> CredentialCache::fetch(Slot& slot, Fetcher fetcher) {
+    Result result;
+    try {
+        result = co_await fetcher();
+    } catch (const std::exception& e) {
+        result = std::unexpected(ProviderFailure{make_error_code(ProviderErrc::BadResponse), e.what(), {}});
+    }
+    auto now = std::chrono::steady_clock::now();
+    std::vector<std::shared_ptr<AsyncSignal>> waiters;
+    {
+        std::lock_guard lk(slot.mtx);
+        if (result) {
+            auto ahead = std::min(std::chrono::seconds(m_cfg.refresh_ahead), slot.ttl / 2);
+            Credential credential{
+                .value = result.value(),
+                .fetched_at = now,
+                .refresh_at = now + slot.ttl - ahead,
+                .expires_at = now + slot.ttl,
+            };
+            publish(slot, &credential);
+            slot.failure.reset();
+        } else {
+            SPDLOG_WARN("credential fetch failed: {}", result.error().detail);
+            slot.failures.fetch_add(1, std::memory_order_relaxed);
+            slot.failure = result.error();
+        }
+        slot.fetching = false;
+        waiters.swap(slot.waiters);
+    }
+    for (auto& waiter : waiters)
+        waiter->notify();
+    co_return result;
+}
+
+void CredentialCache::publish(Slot& slot, const Credential* credential) {
+    for (std::size_t i = 0; i < m_shard_num; ++i)
+        slot.shards[i].credential.store(credential ? std::make_shared<const Credential>(*credential) : nullptr,
+                                        std::memory_order_release);
+}
@@ -0,0 +1,55 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include <openssl/evp.h>
+
+#include "crypto.h"
+
+namespace {
+
+template <std::size_t N>
+std::array<unsigned char, N> digest(std::string_view data, const EVP_MD* md) {
+    std::array<unsigned char, N> result;
+    unsigned int size{0};
+    if (!EVP_Digest(data.data(), data.size(), result.data(), &size, md, nullptr) || size != N)
+        throw std::runtime_error("EVP_Digest failed");
+    return result;
+}
+
+}  // namespace
+
+std::array<unsigned char, 16> md5Digest(std::string_view data) {
+    return digest<16>(data, EVP_md5());
+}
+
+std::array<unsigned char, 32> sha256Digest(std::string_view data) {
+    return digest<32>(data, EVP_sha256());
+}
+
+std::string toHex(std::span<const unsigned char> bytes) {
+    static constexpr char digits[] = "0123456789abcdef";
+    std::string hex(bytes.size() * 2, '\0');
+    for (std::size_t i = 0; i < bytes.size(); ++i) {
+        hex[2 * i] = digits[bytes[i] >> 4];
+        hex[2 * i + 1] = digits[bytes[i] & 0x0f];
+    }
+    return hex;
+}
+
+std::mt19937_64& randomEngine() {
+    static thread_local std::mt19937_64 engine{std::random_device{}()};
+    return engine;
+}
+
+std::string randomHex(std::size_t length) {
+    static constexpr char digits[] = "0123456789abcdef";
+    auto& engine = randomEngine();
+    std::string hex(length, '\0');
+    // every draw gives 16 digits
+    for (std::size_t i = 0; i < length; i += 16) {
+        auto bits = engine();
+        for (std::size_t j = i; j < std::min(length, i + 16); ++j, bits >>= 4)
+            hex[j] = digits[bits & 0x0f];
+    }
+    return hex;
+}
@@ -0,0 +1,544 @@
+#include <algorithm>
+#include <cctype>
+#include <format>
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <tuple>
+
+#include <spdlog/spdlog.h>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/experimental/awaitable_operators.hpp>
+#include <boost/asio/experimental/channel.hpp>
+#include <boost/asio/experimental/channel_error.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include "dispatcher.h"
+#include "helper.hpp"
+
+namespace {
+
+class DispatchCategory final : public boost::system::error_category {
+public:
+    const char* name() const noexcept override { return "dispatch"; }
+
+    std::string message(int ev) const override {
+        switch (static_cast<DispatchCode>(ev)) {
+            case DispatchCode::ServedBy:
+                return "served by";
+        }
+        return "unknown dispatch code";
+    }
+};
+
+const boost::system::error_category& dispatchCategory() {
+    static DispatchCategory category;
+    return category;
+}
+
+// what a provider said, tagged with its attempt index, a channel_closed error marks the end of the attempt
+using Events = boost::asio::experimental::channel<void(boost::system::error_code, std::size_t, std::string)>;
+
+constexpr std::size_t CHANNEL_CAPACITY = 4096;
+// a routed model ranks providers by the expected seconds until an answer of this many tokens is complete
+constexpr double EXPECTED_TOKENS = 200;
+// expected seconds for a provider that never finished a conversation successfully
+constexpr double UNKNOWN_SECONDS = 60;
+// 429 answers waited out before the conversation fails with it
+constexpr std::size_t MAX_RATE_LIMIT_RETRIES = 2;
+
+// Starts a provider and relays everything it sends to events.
+std::shared_ptr<FreeGpt::Channel> launch(const boost::asio::any_io_executor& executor, const GptCallback& func,
+                                         nlohmann::json json, std::size_t index, std::shared_ptr<Events> events) {
+    auto ch = spawnProvider(executor, func, std::move(json));
+    boost::asio::co_spawn(
+        executor,
+        [](auto ch, auto events, std::size_t index) -> boost::asio::awaitable<void> {
+            while (true) {
+                auto [ec, str] = co_await ch->async_receive(use_nothrow_awaitable);
+                if (ec && !isProviderError(ec))
+                    break;
+                co_await events->async_send(ec, index, std::move(str), use_nothrow_awaitable);
+            }
+            co_await events->async_send(boost::asio::experimental::error::channel_closed, index, std::string{},
+                                        use_nothrow_awaitable);
+        }(ch, std::move(events), index),
+        boost::asio::detached);
+    return ch;
+}
+
+// cloudflare and friends answer 200 with a challenge page where a token stream was expected
+bool isHtml(std::string_view str) {
+    auto pos = str.find_first_not_of(" \t\r\n");
+    if (pos == std::string_view::npos)
+        return false;
+    str = str.substr(pos);
+    auto starts_with = [&](std::string_view prefix) {
+        if (str.size() < prefix.size())
+            return false;
+        return std::ranges::equal(str.substr(0, prefix.size()), prefix,
+                                  [](char a, char b) { return std::tolower(static_cast<unsigned char>(a)) == b; });
+    };
+    return starts_with("<!doctype html") || starts_with("<html");
+}
+
+}  // namespace
+
+std::shared_ptr<FreeGpt::Channel> spawnProvider(const boost::asio::any_io_executor& executor, const GptCallback& func,
+                                                nlohmann::json json) {
+    auto ch = std::make_shared<FreeGpt::Channel>(executor, CHANNEL_CAPACITY);
+    boost::asio::co_spawn(executor, func(ch, std::move(json)), [ch](std::exception_ptr eptr) {
+        try {
+            if (eptr)
+                std::rethrow_exception(eptr);
+        } catch (const std::exception& e) {
+            SPDLOG_ERROR("Caught exception: {}", e.what());
+        }
+        // a provider that threw before arming its own close would leave the reader waiting forever
+        ch->close();
+    });
+    return ch;
+}
+
+boost::system::error_code make_error_code(DispatchCode e) {
+    return {static_cast<int>(e), dispatchCategory()};
+}
+
+bool isServedBy(const boost::system::error_code& ec) {
+    return ec == DispatchCode::ServedBy;
+}
+
+Dispatcher::Dispatcher(std::unordered_map<std::string, GptCallback>& functions, CircuitBreaker& breaker,
+                       UpstreamPacer& pacer)
+    : m_functions(functions), m_breaker(breaker), m_pacer(pacer) {}
+
+void Dispatcher::instrumentProviders(const std::vector<TokenTimeoutRule>& token_timeouts) {
+    for (auto& [provider, func] : m_functions) {
+        auto it = std::ranges::find_if(
+            token_timeouts, [&](auto& rule) { return rule.provider.empty() || rule.provider == provider; });
+        auto timeouts = it == token_timeouts.end() ? TokenTimeoutRule{} : *it;
+        auto paced = std::bind_front(&Dispatcher::pace, this, provider, std::move(func));
+        func = std::bind_front(&Dispatcher::measure, this, provider, std::move(timeouts), std::move(paced));
+    }
+}
+
+void Dispatcher::addHedgedModels(const std::vector<HedgeConfig>& hedged_models) {
+    for (auto& cfg : hedged_models) {
+        auto model = std::make_unique<VirtualModel>();
+        model->kind = Kind::Hedged;
+        model->model = cfg.model;
+        model->hedge_delay = std::chrono::milliseconds(cfg.delay);
+        add(std::move(model), cfg.providers);
+    }
+}
+
+void Dispatcher::addFailoverModels(const std::vector<FailoverConfig>& failover_models) {
+    for (auto& cfg : failover_models) {
+        auto model = std::make_unique<VirtualModel>();
+        model->kind = Kind::Failover;
+        model->model = cfg.model;
+        add(std::move(model), cfg.providers);
+    }
+}
+
+void Dispatcher::addRoutedModels(const std::vector<RouterConfig>& routed_models) {
+    for (auto& cfg : routed_models) {
+        auto model = std::make_unique<VirtualModel>();
+        model->kind = Kind::Routed;
+        model->model = cfg.model;
+        model->exploration = std::clamp(cfg.exploration, 0.0, 1.0);
+        model->max_attempts = std::max<std::size_t>(cfg.max_attempts, 1);
+        auto providers = cfg.providers;
+        if (providers.empty()) {
+            // only real providers, virtual models live in the same map
+            for (auto& [provider, _] : m_functions) {
+                if (std::ranges::none_of(m_models, [&](auto& item) { return item->model == provider; }))
+                    providers.emplace_back(provider);
+            }
+            std::ranges::sort(providers);
+        }
+        add(std::move(model), providers);
+    }
+}
+
+nlohmann::json Dispatcher::weights() {
+    std::lock_guard lk(m_mtx);
+    nlohmann::json weights = nlohmann::json::object();
+    for (auto& model : m_models) {
+        if (model->kind != Kind::Routed)
+            continue;
+        auto& item = weights[model->model];
+        item = nlohmann::json::object();
+        for (std::size_t i = 0; i < model->providers.size(); ++i)
+            item[model->providers[i]] = model->weights[i];
+    }
+    return weights;
+}
+
+std::expected<void, std::string> Dispatcher::setWeights(const nlohmann::json& weights) {
+    if (!weights.is_object())
+        return std::unexpected("expected {\"model\": {\"provider\": weight}}");
+    std::lock_guard lk(m_mtx);
+    // validate everything before applying anything
+    std::vector<std::tuple<VirtualModel*, std::size_t, double>> updates;
+    for (auto& [model_name, provider_weights] : weights.items()) {
+        auto it = std::ranges::find_if(
+            m_models, [&](auto& item) { return item->kind == Kind::Routed && item->model == model_name; });
+        if (it == m_models.end())
+            return std::unexpected(std::format("unknown routed model: {}", model_name));
+        if (!provider_weights.is_object())
+            return std::unexpected(std::format("expected an object of weights for {}", model_name));
+        auto& model = **it;
+        for (auto& [provider, weight] : provider_weights.items()) {
+            auto pos = std::ranges::find(model.providers, provider);
+            if (pos == model.providers.end())
+                return std::unexpected(std::format("{} doesn't route to {}", model_name, provider));
+            if (!weight.is_number() || weight.get<double>() < 0)
+                return std::unexpected(std::format("invalid weight for {}: {}", provider, weight.dump()));
+            updates.emplace_back(&model, pos - model.providers.begin(), weight.get<double>());
+        }
+    }
+    for (auto& [model, index, weight] : updates) {
+        SPDLOG_INFO("[{}] weight of [{}]: {}", model->model, model->providers[index], weight);
+        model->weights[index] = weight;
+    }
+    return {};
+}
+
+nlohmann::json Dispatcher::metrics() {
+    std::lock_guard lk(m_mtx);
+    nlohmann::json metrics = nlohmann::json::object();
+    for (auto& model : m_models) {
+        auto& item = metrics[kindName(model->kind)][model->model];
+        item["requests"] = model->requests;
+        item["retries"] = model->retries;
+        item["failed"] = model->failed;
+        for (std::size_t i = 0; i < model->providers.size(); ++i)
+            item["served"][model->providers[i]] = model->served[i];
+    }
+    metrics["providers"] = m_stats.metrics();
+    return metrics;
+}
+
+std::string_view Dispatcher::kindName(Kind kind) {
+    switch (kind) {
+        case Kind::Hedged:
+            return "hedged";
+        case Kind::Failover:
+            return "failover";
+        case Kind::Routed:
+            return "routed";
+    }
+    return "unknown";
+}
+
+void Dispatcher::add(std::unique_ptr<VirtualModel> model, const std::vector<std::string>& providers) {
+    for (auto& provider : providers) {
+        if (!m_functions.contains(provider)) {
+            SPDLOG_WARN("{} model [{}]: unknown provider [{}]", kindName(model->kind), model->model, provider);
+            continue;
+        }
+        model->providers.emplace_back(provider);
+    }
+    if (model->providers.empty() || m_functions.contains(model->model)) {
+        SPDLOG_ERROR("{} model [{}] is not registered", kindName(model->kind), model->model);
+        return;
+    }
+    model->weights.resize(model->providers.size(), 1);
+    model->served.resize(model->providers.size());
+    m_functions[model->model] = std::bind_front(&Dispatcher::serve, this, std::ref(*model));
+    m_models.emplace_back(std::move(model));
+}
+
+std::vector<std::size_t> Dispatcher::rank(VirtualModel& model) {
+    std::vector<std::size_t> order(model.providers.size());
+    std::iota(order.begin(), order.end(), 0);
+    if (model.kind != Kind::Routed)
+        return order;
+    std::vector<double> weights;
+    {
+        std::lock_guard lk(m_mtx);
+        weights = model.weights;
+    }
+    std::vector<std::pair<double, std::size_t>> scores;
+    for (std::size_t i = 0; i < model.providers.size(); ++i) {
+        if (weights[i] <= 0)
+            continue;
+        // a provider nobody asked yet goes first once, that is how it gets statistics at all
+        auto score = std::numeric_limits<double>::infinity();
+        if (auto snapshot = m_stats.get(model.providers[i])) {
+            auto seconds = UNKNOWN_SECONDS;
+            if (snapshot->requests > snapshot->failures)
+                seconds = snapshot->ttft_ms / 1000 + EXPECTED_TOKENS / std::max(snapshot->tokens_per_sec, 1.0);
+            score = weights[i] * snapshot->success_rate / seconds;
+        }
+        scores.emplace_back(score, i);
+    }
+    std::ranges::stable_sort(scores, std::ranges::greater{}, [](auto& item) { return item.first; });
+    order.clear();
+    for (auto& [_, index] : scores)
+        order.emplace_back(index);
+
+    thread_local std::mt19937 rng{std::random_device{}()};
+    if (order.size() > 1 && std::uniform_real_distribution<double>{0, 1}(rng) < model.exploration) {
+        std::vector<double> order_weights;
+        for (auto index : order)
+            order_weights.emplace_back(weights[index]);
+        auto chosen = std::discrete_distribution<std::size_t>{order_weights.begin(), order_weights.end()}(rng);
+        std::rotate(order.begin(), order.begin() + chosen, order.begin() + chosen + 1);
+    }
+    if (order.size() > model.max_attempts)
+        order.resize(model.max_attempts);
+    return order;
+}
+
+boost::asio::awaitable<void> Dispatcher::serve(VirtualModel& model, std::shared_ptr<FreeGpt::Channel> ch,
+                                               nlohmann::json json) {
+    ScopeExit auto_exit{[&] { ch->close(); }};
+    auto executor = co_await boost::asio::this_coro::executor;
+    {
+        std::lock_guard lk(m_mtx);
+        ++model.requests;
+    }
+    auto order = rank(model);
+    if (order.empty()) {
+        co_await ch->async_send(make_error_code(ProviderErrc::Unavailable),
+                                std::format("{}: every provider is weighted out", model.model), use_nothrow_awaitable);
+        co_return;
+    }
+
+    auto events = std::make_shared<Events>(executor, CHANNEL_CAPACITY);
+    std::vector<std::shared_ptr<FreeGpt::Channel>> attempts;
+    // attempts that failed before their first token, whatever they still send is ignored
+    std::vector<bool> dropped;
+    // a provider whose channel is closed stops reading its upstream at the next piece it tries to send
+    ScopeExit close_attempts{[&] {
+        events->close();
+        for (auto& attempt : attempts)
+            attempt->close();
+    }};
+    auto provider = [&](std::size_t index) -> const std::string& { return model.providers[order[index]]; };
+
+    boost::asio::steady_timer timer(executor);
+    auto next_launch = std::chrono::steady_clock::now();
+    auto launch_next = [&] {
+        auto index = attempts.size();
+        if (index > 0) {
+            std::lock_guard lk(m_mtx);
+            ++model.retries;
+        }
+        SPDLOG_INFO("[{}] ask [{}]", model.model, provider(index));
+        attempts.emplace_back(launch(executor, m_functions.at(provider(index)), json, index, events));
+        dropped.emplace_back(false);
+        if (model.hedge_delay)
+            next_launch = std::chrono::steady_clock::now() + model.hedge_delay.value();
+    };
+    launch_next();
+
+    using namespace boost::asio::experimental::awaitable_operators;
+    std::optional<std::size_t> winner;
+    std::size_t finished{0};
+    boost::system::error_code last_ec;
+    std::string last_error;
+    while (true) {
+        std::tuple<boost::system::error_code, std::size_t, std::string> event;
+        if (!winner && model.hedge_delay && attempts.size() < order.size()) {
+            timer.expires_at(next_launch);
+            auto result = co_await (events->async_receive(use_nothrow_awaitable) ||
+                                    timer.async_wait(use_nothrow_awaitable));
+            if (result.index() == 1) {
+                launch_next();
+                continue;
+            }
+            event = std::move(std::get<0>(result));
+        } else {
+            event = co_await events->async_receive(use_nothrow_awaitable);
+        }
+        auto& [ec, index, str] = event;
+        if (ec == boost::asio::experimental::error::channel_closed) {
+            if (winner == index)
+                co_return;
+            if (winner || ++finished < attempts.size())
+                continue;
+            // everything asked so far failed before its first token
+            if (attempts.size() < order.size()) {
+                launch_next();
+                continue;
+            }
+            {
+                std::lock_guard lk(m_mtx);
+                ++model.failed;
+            }
+            SPDLOG_ERROR("[{}] all providers failed", model.model);
+            if (!last_ec)
+                last_ec = make_error_code(ProviderErrc::BadResponse);
+            co_await ch->async_send(last_ec, std::move(last_error), use_nothrow_awaitable);
+            co_return;
+        }
+        if ((winner && winner != index) || dropped[index])
+            continue;
+        if (!winner) {
+            if (ec) {
+                SPDLOG_WARN("[{}] [{}] failed: {}", model.model, provider(index), str);
+                dropped[index] = true;
+                last_ec = ec;
+                last_error = std::move(str);
+                continue;
+            }
+            if (str.empty())
+                continue;
+            winner = index;
+            SPDLOG_INFO("[{}] served by [{}]", model.model, provider(index));
+            {
+                std::lock_guard lk(m_mtx);
+                ++model.served[order[index]];
+            }
+            for (std::size_t i = 0; i < attempts.size(); ++i) {
+                if (i != index)
+                    attempts[i]->close();
+            }
+            co_await ch->async_send(make_error_code(DispatchCode::ServedBy), provider(index), use_nothrow_awaitable);
+        }
+        co_await ch->async_send(ec, std::move(str), use_nothrow_awaitable);
+    }
+}
+
+boost::asio::awaitable<void> Dispatcher::measure(std::string provider, TokenTimeoutRule timeouts, GptCallback func,
+                                                 std::shared_ptr<FreeGpt::Channel> ch, nlohmann::json json) {
+    ScopeExit auto_exit{[&] { ch->close(); }};
+    auto permit = m_breaker.tryAcquire(provider);
+    if (!permit) {
+        co_await ch->async_send(make_error_code(ProviderErrc::Unavailable),
+                                std::format("{} is failing, try again later", provider), use_nothrow_awaitable);
+        co_return;
+    }
+    auto executor = co_await boost::asio::this_coro::executor;
+    auto start = std::chrono::steady_clock::now();
+    auto inner = spawnProvider(executor, func, std::move(json));
+    std::optional<std::chrono::steady_clock::time_point> first_token;
+    std::size_t bytes{0};
+    bool failed{false};
+    bool timed_out{false};
+    bool rate_limited{false};
+    boost::asio::steady_timer timer(executor);
+    using namespace boost::asio::experimental::awaitable_operators;
+    while (true) {
+        // the first token deadline runs from the start, the idle one restarts with every message
+        std::size_t seconds = first_token ? timeouts.idle : timeouts.first_token;
+        boost::system::error_code ec;
+        std::string str;
+        // a stall or a html page ends the attempt here, whatever inner still has queued is not forwarded
+        bool aborted{false};
+        if (seconds == 0) {
+            std::tie(ec, str) = co_await inner->async_receive(use_nothrow_awaitable);
+        } else {
+            if (first_token)
+                timer.expires_after(std::chrono::seconds(seconds));
+            else
+                timer.expires_at(start + std::chrono::seconds(seconds));
+            auto result = co_await (inner->async_receive(use_nothrow_awaitable) ||
+                                    timer.async_wait(use_nothrow_awaitable));
+            if (result.index() == 0) {
+                std::tie(ec, str) = std::move(std::get<0>(result));
+            } else {
+                SPDLOG_WARN("[{}] stalled, no token for {}s", provider, seconds);
+                ec = make_error_code(ProviderErrc::Stalled);
+                str = std::format("{} stalled, no {} for {}s", provider, first_token ? "token" : "first token",
+                                  seconds);
+                inner->close();
+                aborted = true;
+            }
+        }
+        if (ec && !isProviderError(ec))
+            break;
+        if (!ec && !first_token && isHtml(str)) {
+            ec = make_error_code(ProviderErrc::BadResponse);
+            str = std::format("{} answered with a html page", provider);
+            inner->close();
+            aborted = true;
+        }
+        if (ec) {
+            failed = true;
+            timed_out |= ec == ProviderErrc::Timeout || ec == ProviderErrc::Stalled;
+            rate_limited |= ec == ProviderErrc::RateLimited;
+        } else if (!str.empty()) {
+            if (!first_token)
+                first_token = std::chrono::steady_clock::now();
+            bytes += str.size();
+        }
+        auto [send_ec] = co_await ch->async_send(ec, std::move(str), use_nothrow_awaitable);
+        if (send_ec) {
+            // the conversation was dropped because another provider won, that says nothing about this one
+            inner->close();
+            m_breaker.onAbandoned(permit.value());
+            co_return;
+        }
+        if (aborted)
+            break;
+    }
+    if (failed || !first_token) {
+        m_stats.recordFailure(provider, timed_out);
+        // pacing deals with 429 answers, they don't mean the provider is broken
+        if (rate_limited)
+            m_breaker.onAbandoned(permit.value());
+        else
+            m_breaker.onFailure(permit.value());
+        co_return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    auto ttft = std::chrono::duration_cast<std::chrono::milliseconds>(first_token.value() - start);
+    m_breaker.onSuccess(permit.value(), ttft);
+    // a floor, single chunk answers would report an absurd rate otherwise
+    auto seconds = std::max(std::chrono::duration<double>(now - first_token.value()).count(), 0.1);
+    m_stats.recordSuccess(provider, ttft, static_cast<double>(bytes) / 4 / seconds);
+}
+
+boost::asio::awaitable<void> Dispatcher::pace(std::string provider, GptCallback func,
+                                              std::shared_ptr<FreeGpt::Channel> ch, nlohmann::json json) {
+    ScopeExit auto_exit{[&] { ch->close(); }};
+    auto executor = co_await boost::asio::this_coro::executor;
+    for (std::size_t attempt = 0;; ++attempt) {
+        if (!co_await m_pacer.acquire(provider)) {
+            co_await ch->async_send(make_error_code(ProviderErrc::Unavailable),
+                                    std::format("{} is rate limited, try again later", provider),
+                                    use_nothrow_awaitable);
+            co_return;
+        }
+        auto inner = spawnProvider(executor, func, json);
+        bool answered{false};
+        bool retry{false};
+        std::optional<std::chrono::seconds> retry_after;
+        while (true) {
+            auto [ec, str] = co_await inner->async_receive(use_nothrow_awaitable);
+            if (ec == ProviderHint::RetryAfter) {
+                retry_after = parseRetryAfter(str);
+                continue;
+            }
+            if (ec && !isProviderError(ec))
+                break;
+            if (ec == ProviderErrc::RateLimited) {
+                m_pacer.onRateLimited(provider, retry_after);
+                if (!answered && attempt < MAX_RATE_LIMIT_RETRIES) {
+                    SPDLOG_INFO("[{}] rate limited, wait for the next slot", provider);
+                    inner->close();
+                    retry = true;
+                    break;
+                }
+            } else if (!ec && !str.empty()) {
+                answered = true;
+            }
+            auto [send_ec] = co_await ch->async_send(ec, std::move(str), use_nothrow_awaitable);
+            if (send_ec) {
+                inner->close();
+                co_return;
+            }
+        }
+        if (retry)
+            continue;
+        if (answered)
+            m_pacer.onSuccess(provider);
+        co_return;
+    }
+}
@@ -0,0 +1,46 @@
+#include <algorithm>
+#include <cctype>
+
+#include "http_parsers.h"
+
+std::optional<ProxyUrl> parseProxyUrl(std::string_view url) {
+    auto scheme_end = url.find("://");
+    if (scheme_end == std::string_view::npos || url.contains(' '))
+        return std::nullopt;
+    auto scheme = url.substr(0, scheme_end);
+    auto is_scheme = [&](std::string_view expected) {
+        return std::ranges::equal(scheme, expected, [](unsigned char a, char b) { return std::tolower(a) == b; });
+    };
+    if (!is_scheme("http") && !is_scheme("https"))
+        return std::nullopt;
+    auto authority = url.substr(scheme_end + 3);
+    authority = authority.substr(0, authority.find_first_of("/?#"));
+    ProxyUrl proxy;
+    if (auto at = authority.find('@'); at != std::string_view::npos) {
+        auto userinfo = authority.substr(0, at);
+        auto colon = userinfo.find(':');
+        if (colon == 0 || colon == std::string_view::npos || colon + 1 == userinfo.size())
+            return std::nullopt;
+        proxy.username = userinfo.substr(0, colon);
+        proxy.password = userinfo.substr(colon + 1);
+        authority.remove_prefix(at + 1);
+    }
+    auto colon = authority.find(':');
+    proxy.host = authority.substr(0, colon);
+    if (colon != std::string_view::npos)
+        proxy.port = authority.substr(colon + 1);
+    if (proxy.host.empty() || !std::ranges::all_of(proxy.port, [](unsigned char c) { return std::isdigit(c); }))
+        return std::nullopt;
+    return proxy;
+}
+
+void parseHeaderLines(std::string_view block, std::multimap<std::string, std::string>& headers) {
+    while (!block.empty()) {
+        auto line = block.substr(0, block.find_first_of("\r\n"));
+        block.remove_prefix(std::min(line.size() + 1, block.size()));
+        auto colon = line.find(':');
+        if (colon == 0 || colon == std::string_view::npos || colon + 1 == line.size())
+            continue;
+        headers.emplace(line.substr(0, colon), line.substr(colon + 1));
+    }
+}
@@ -0,0 +1,80 @@
+#include <charconv>
+
+#include <spdlog/spdlog.h>
+
+#include "ip_allow_list.h"
+
+IpAllowList::IpAllowList(const std::vector<std::string>& entries) : m_trie(build(entries)) {}
+
+void IpAllowList::reload(const std::vector<std::string>& entries) {
+    auto trie = build(entries);
+    SPDLOG_INFO("reload ip white list, {} of {} entries", trie->entries, entries.size());
+    m_trie.store(std::move(trie));
+}
+
+bool IpAllowList::allowed(const Bytes& bytes) const {
+    auto trie = m_trie.load();
+    if (trie->allow_all)
+        return true;
+    auto& nodes = trie->nodes;
+    uint32_t index = 0;
+    for (std::size_t bit = 0; bit < bytes.size() * 8; ++bit) {
+        if (nodes[index].terminal)
+            return true;
+        index = nodes[index].children[(bytes[bit / 8] >> (7 - bit % 8)) & 1];
+        if (index == 0)
+            return false;
+    }
+    return nodes[index].terminal;
+}
+
+IpAllowList::Bytes IpAllowList::toBytes(const boost::asio::ip::address& address) {
+    if (address.is_v4())
+        return boost::asio::ip::make_address_v6(boost::asio::ip::v4_mapped, address.to_v4()).to_bytes();
+    return address.to_v6().to_bytes();
+}
+
+std::shared_ptr<const IpAllowList::Trie> IpAllowList::build(const std::vector<std::string>& entries) {
+    auto trie = std::make_shared<Trie>();
+    trie->allow_all = entries.empty();
+    for (auto& entry : entries) {
+        std::string_view ip{entry};
+        std::string_view prefix;
+        if (auto pos = ip.find('/'); pos != std::string_view::npos) {
+            prefix = ip.substr(pos + 1);
+            ip = ip.substr(0, pos);
+        }
+        boost::system::error_code ec;
+        auto address = boost::asio::ip::make_address(std::string{ip}, ec);
+        if (ec) {
+            SPDLOG_ERROR("invalid ip white list entry: [{}]", entry);
+            continue;
+        }
+        std::size_t max_length = address.is_v4() ? 32 : 128;
+        std::size_t length = max_length;
+        if (!prefix.empty()) {
+            auto [ptr, errc] = std::from_chars(prefix.data(), prefix.data() + prefix.size(), length);
+            if (errc != std::errc{} || ptr != prefix.data() + prefix.size() || length > max_length) {
+                SPDLOG_ERROR("invalid ip white list prefix: [{}]", entry);
+                continue;
+            }
+        }
+        if (address.is_v4())
+            length += 96;
+        auto bytes = toBytes(address);
+        uint32_t index = 0;
+        for (std::size_t bit = 0; bit < length; ++bit) {
+            auto branch = (bytes[bit / 8] >> (7 - bit % 8)) & 1;
+            if (trie->nodes[index].children[branch] == 0) {
+                trie->nodes[index].children[branch] = static_cast<uint32_t>(trie->nodes.size());
+                trie->nodes.emplace_back();
+            }
+            index = trie->nodes[index].children[branch];
+        }
+        trie->nodes[index].terminal = true;
+        ++trie->entries;
+    }
+    if (!entries.empty() && trie->entries == 0)
+        SPDLOG_ERROR("no valid ip white list entry, every client is refused");
+    return trie;
+}
@@ -1,8 +1,11 @@
 #define OPEN_YAML_TO_JSON
 
+#include <array>
+#include <cstddef>
+#include <expected>
 #include <format>
 #include <functional>
-#include <regex>
+#include <memory_resource>
 #include <semaphore>
 #include <string>
 
@@ -12,24 +15,78 @@
 #include <boost/asio/as_tuple.hpp>
 #include <boost/asio/co_spawn.hpp>
 #include <boost/asio/detached.hpp>
-#include <boost/asio/experimental/awaitable_operators.hpp>
 
 #include <curl/curl.h>
+#include <openssl/crypto.h>
 #include <spdlog/spdlog.h>
 #include <inja/inja.hpp>
 
 #include "cfg.h"
+#include "circuit_breaker.h"
+#include "coalescer.h"
+#include "connection_governor.h"
+#include "conversation_key.h"
+#include "conversation_sessions.h"
+#include "credential_cache.h"
+#include "crypto.h"
+#include "dispatcher.h"
 #include "free_gpt.h"
 #include "helper.hpp"
+#include "ip_allow_list.h"
+#include "rate_limiter.h"
+#include "response_cache.h"
+#include "scheduler.h"
+#include "timer_wheel.h"
+#include "upstream_pacer.h"
+#include "utf8_carry.h"
 
 constexpr std::string_view ASSETS_PATH{"/assets"};
 constexpr std::string_view API_PATH{"/backend-api/v2/conversation"};
+constexpr std::string_view METRICS_PATH{"/backend-api/v2/metrics"};
+constexpr std::string_view ADMIN_WEIGHTS_PATH{"/backend-api/v2/admin/weights"};
+// initial block of the per connection arena, larger requests continue on the heap
+constexpr std::size_t SESSION_ARENA_SIZE{16 * 1024};
+
+// A request and the headers of its streamed answer are allocated from an arena of the connection, released before
+// the next request is read so a keep-alive connection reuses the same memory instead of going through the heap.
+using ArenaAllocator = std::pmr::polymorphic_allocator<char>;
+using ArenaFields = boost::beast::http::basic_fields<ArenaAllocator>;
+using ArenaStringBody = boost::beast::http::basic_string_body<char, std::char_traits<char>, ArenaAllocator>;
+
+// the routes under chat_path, formatted once at startup
+struct Routes {
+    std::string assets;
+    std::string api;
+    std::string metrics;
+    std::string admin_weights;
+};
 
-using GptCallback = std::function<boost::asio::awaitable<void>(std::shared_ptr<FreeGpt::Channel>, nlohmann::json)>;
 inline std::unordered_map<std::string, GptCallback> gpt_function;
+inline std::unique_ptr<Dispatcher> dispatcher;
+inline std::unique_ptr<FairScheduler> fair_scheduler;
+inline std::unique_ptr<RateLimiter> rate_limiter;
+inline std::unique_ptr<IpAllowList> ip_allow_list;
+inline std::unique_ptr<ConnectionGovernor> connection_governor;
+inline std::unique_ptr<CircuitBreaker> circuit_breaker;
+inline std::unique_ptr<UpstreamPacer> upstream_pacer;
+inline std::unique_ptr<Coalescer> coalescer;
+inline std::unique_ptr<ResponseCache> response_cache;
+inline std::shared_ptr<CredentialCache> credential_cache;
+inline std::shared_ptr<ConversationSessions> conversation_sessions;
+inline std::function<nlohmann::json()> session_pool_metrics;
+inline Routes routes;
 
 #define ADD_METHOD(name, function) gpt_function[name] = std::bind_front(&function, app);
 
+void setIpWhiteList(auto& cfg) {
+    // export IP_WHITE_LIST="[\"127.0.0.1\",\"192.168.0.0/16\",\"2001:db8::/32\"]"
+    if (auto [ip_white_list_str] = getEnv("IP_WHITE_LIST"); !ip_white_list_str.empty()) {
+        nlohmann::json ip_white_list = nlohmann::json::parse(ip_white_list_str, nullptr, false);
+        if (!ip_white_list.is_discarded())
+            cfg.ip_white_list = ip_white_list.get<std::vector<std::string>>();
+    }
+}
+
 void setEnvironment(auto& cfg) {
     setenv("CURL_IMPERSONATE", "chrome110", 1);
     if (cfg.enable_proxy) {
@@ -59,14 +116,13 @@ void setEnvironment(auto& cfg) {
         cfg.api_key = std::move(api_key);
     if (auto [interval] = getEnv("INTERVAL"); !interval.empty())
         cfg.interval = std::atol(interval.c_str());
-    // export IP_WHITE_LIST="[\"127.0.0.1\",\"192.168.1.1\"]"
-    if (auto [ip_white_list_str] = getEnv("IP_WHITE_LIST"); !ip_white_list_str.empty()) {
-        nlohmann::json ip_white_list = nlohmann::json::parse(ip_white_list_str, nullptr, false);
-        if (!ip_white_list.is_discarded())
-            cfg.ip_white_list = ip_white_list.get<std::vector<std::string>>();
-    }
+    setIpWhiteList(cfg);
     if (auto [zeus] = getEnv("ZEUS"); !zeus.empty())
         cfg.zeus = std::move(zeus);
+    if (auto [max_concurrent_requests] = getEnv("MAX_CONCURRENT_REQUESTS"); !max_concurrent_requests.empty())
+        cfg.scheduler.max_concurrent_requests = std::atol(max_concurrent_requests.c_str());
+    if (auto [max_connections] = getEnv("MAX_CONNECTIONS"); !max_connections.empty())
+        cfg.connection.max_connections = std::atol(max_connections.c_str());
 }
 
 std::string createIndexHtml(const std::string& file, const Config& cfg) {
@@ -74,15 +130,30 @@ std::string createIndexHtml(const std::string& file, const Config& cfg) {
     nlohmann::json data;
     data["chat_id"] = createUuidString();
     data["chat_path"] = cfg.chat_path;
+    // providers with an open circuit breaker are hidden until they are due for probing
+    data["model_list"] = nlohmann::json::array();
     if (!cfg.providers.empty()) {
-        data["model_list"] = cfg.providers;
+        for (auto& m : cfg.providers) {
+            if (circuit_breaker->available(m))
+                data["model_list"].emplace_back(m);
+        }
     } else {
-        for (auto&& m : std::views::keys(gpt_function))
-            data["model_list"].emplace_back(m);
+        for (auto&& m : std::views::keys(gpt_function)) {
+            if (circuit_breaker->available(m))
+                data["model_list"].emplace_back(m);
+        }
     }
     return env.render_file(file, data);
 }
 
+// the Authorization header carries "Bearer <admin_token>", compared without leaking how many bytes of it matched
+bool isAdminToken(std::string_view authorization, std::string_view token) {
+    constexpr std::string_view scheme{"Bearer "};
+    if (token.empty() || authorization.size() != scheme.size() + token.size() || !authorization.starts_with(scheme))
+        return false;
+    return CRYPTO_memcmp(authorization.data() + scheme.size(), token.data(), token.size()) == 0;
+}
+
 boost::asio::awaitable<void> sendHttpResponse(auto& stream, auto& request, auto status) {
     boost::beast::http::response<boost::beast::http::string_body> res{status, request.version()};
     res.set(boost::beast::http::field::server, BOOST_BEAST_VERSION_STRING);
@@ -94,6 +165,88 @@ boost::asio::awaitable<void> sendHttpResponse(auto& stream, auto& request, auto
     co_return;
 }
 
+boost::asio::awaitable<void> sendJsonResponse(auto& stream, auto& request, const nlohmann::json& json,
+                                              boost::beast::http::status status = boost::beast::http::status::ok) {
+    boost::beast::http::response<boost::beast::http::string_body> res{status, request.version()};
+    res.set(boost::beast::http::field::server, BOOST_BEAST_VERSION_STRING);
+    res.set(boost::beast::http::field::content_type, "application/json");
+    res.keep_alive(request.keep_alive());
+    res.body() = json.dump();
+    res.prepare_payload();
+    boost::beast::http::message_generator rsp = std::move(res);
+    co_await boost::beast::async_write(stream, std::move(rsp), use_nothrow_awaitable);
+    co_return;
+}
+
+// Replays a cached answer through the same event stream a provider answer takes.
+boost::asio::awaitable<void> sendCachedResponse(auto& stream, auto& request, const ResponseCache::Entry& entry,
+                                                const ResponseCacheConfig& cfg) {
+    boost::beast::http::response<boost::beast::http::buffer_body> res;
+    res.result(boost::beast::http::status::ok);
+    res.version(request.version());
+    res.set(boost::beast::http::field::server, "CppFreeGpt");
+    res.set(boost::beast::http::field::transfer_encoding, "chunked");
+    res.set(boost::beast::http::field::content_type, "text/event-stream");
+    res.set("X-Provider", entry.provider);
+    res.set("X-Cache", "HIT");
+    res.body().data = nullptr;
+    res.body().more = true;
+    boost::beast::http::response_serializer<boost::beast::http::buffer_body, boost::beast::http::fields> sr{res};
+    auto [ec, count] = co_await boost::beast::http::async_write_header(stream, sr, use_nothrow_awaitable);
+    if (ec) {
+        SPDLOG_ERROR("{}", ec.message());
+        co_return;
+    }
+    std::string_view answer{*entry.answer};
+    boost::asio::steady_timer timer(co_await boost::asio::this_coro::executor);
+    // a cut inside a utf-8 sequence is moved to the end of it, the carry holds the partial character back
+    Utf8Carry utf8;
+    while (!answer.empty()) {
+        auto size = cfg.replay_chunk == 0 ? answer.size() : std::min(cfg.replay_chunk, answer.size());
+        auto chunk = utf8.feed(std::string{answer.substr(0, size)});
+        answer.remove_prefix(size);
+        if (answer.empty())
+            chunk.append(utf8.flush());
+        if (chunk.empty())
+            continue;
+        res.body().data = chunk.data();
+        res.body().size = chunk.size();
+        res.body().more = true;
+        std::tie(ec, count) = co_await boost::beast::http::async_write(stream, sr, use_nothrow_awaitable);
+        if (ec)
+            co_return;
+        if (!answer.empty() && cfg.replay_chunk != 0 && cfg.replay_interval != 0) {
+            timer.expires_after(std::chrono::milliseconds(cfg.replay_interval));
+            std::tie(ec) = co_await timer.async_wait(use_nothrow_awaitable);
+        }
+    }
+    res.body().data = nullptr;
+    res.body().more = false;
+    std::tie(ec, count) = co_await boost::beast::http::async_write(stream, sr, use_nothrow_awaitable);
+}
+
+boost::asio::awaitable<void> sendTooManyRequests(auto& stream, auto& request, std::chrono::milliseconds retry_after) {
+    boost::beast::http::response<boost::beast::http::string_body> res{boost::beast::http::status::too_many_requests,
+                                                                      request.version()};
+    res.set(boost::beast::http::field::server, BOOST_BEAST_VERSION_STRING);
+    res.set(boost::beast::http::field::retry_after,
+            std::to_string(std::chrono::ceil<std::chrono::seconds>(retry_after).count()));
+    res.keep_alive(request.keep_alive());
+    res.prepare_payload();
+    boost::beast::http::message_generator rsp = std::move(res);
+    co_await boost::beast::async_write(stream, std::move(rsp), use_nothrow_awaitable);
+    co_return;
+}
+
+std::chrono::milliseconds idleTimeout(const Config& cfg) {
+    std::chrono::milliseconds idle = std::chrono::seconds(cfg.interval);
+    std::chrono::milliseconds min_idle = std::chrono::seconds(std::min(cfg.connection.min_idle_timeout, cfg.interval));
+    // full idle timeout up to half of the budget, then shrink linearly to min_idle_timeout
+    auto load = static_cast<double>(connection_governor->active()) / static_cast<double>(connection_governor->limit());
+    auto scale = std::clamp((load - 0.5) * 2, 0.0, 1.0);
+    return idle - std::chrono::duration_cast<std::chrono::milliseconds>((idle - min_idle) * scale);
+}
+
 void setContentType(auto& res, const std::string& file) {
     SPDLOG_INFO("file: {}", file);
     if (file.ends_with("js")) {
@@ -106,10 +259,9 @@ void setContentType(auto& res, const std::string& file) {
         SPDLOG_ERROR("invalid file type: {}", file);
 }
 
-boost::asio::awaitable<void> startSession(boost::asio::ip::tcp::socket sock, Config& cfg,
-                                          boost::asio::io_context& context) {
+boost::asio::awaitable<void> startSession(boost::asio::ip::tcp::socket sock, ConnectionGovernor::Lease lease,
+                                          Config& cfg, boost::asio::io_context& context) {
     boost::beast::tcp_stream stream{std::move(sock)};
-    using namespace boost::asio::experimental::awaitable_operators;
     ScopeExit auto_exit{[&stream] {
         boost::beast::error_code ec;
         stream.socket().shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
@@ -120,9 +272,10 @@ boost::asio::awaitable<void> startSession(boost::asio::ip::tcp::socket sock, Con
         SPDLOG_ERROR("get remote_endpoint error: {}", ec.message());
         co_return;
     }
-    std::string remote_ip{endpoint.address().to_string()};
-    if (!cfg.ip_white_list.empty() && std::ranges::find(cfg.ip_white_list, remote_ip) == cfg.ip_white_list.end()) {
-        SPDLOG_INFO("[{}] not in ip white list.", remote_ip);
+    // ipv4 is keyed in its ipv6 mapped form so both families share one key space
+    auto ip_bytes = IpAllowList::toBytes(endpoint.address());
+    if (!ip_allow_list->allowed(ip_bytes)) {
+        SPDLOG_INFO("[{}] not in ip white list.", endpoint.address().to_string());
         boost::beast::http::response<boost::beast::http::string_body> res{boost::beast::http::status::unauthorized,
                                                                           11};
         res.set(boost::beast::http::field::server, "CppFreeGpt");
@@ -132,27 +285,61 @@ boost::asio::awaitable<void> startSession(boost::asio::ip::tcp::socket sock, Con
         co_await boost::beast::async_write(stream, std::move(rsp), use_nothrow_awaitable);
         co_return;
     }
-    auto assets_path = std::format("{}{}", cfg.chat_path, ASSETS_PATH);
-    auto api_path = std::format("{}{}", cfg.chat_path, API_PATH);
-    SPDLOG_INFO("assets_path: [{}], api_path: [{}]", assets_path, api_path);
+    std::string remote_ip{endpoint.address().to_string()};
+    std::string_view ip_key{reinterpret_cast<const char*>(ip_bytes.data()), ip_bytes.size()};
+    auto& [assets_path, api_path, metrics_path, admin_weights_path] = routes;
+    // idle, header and body deadlines share one wheel entry, expiry cancels whatever read is pending
+    bool timed_out = false;
+    TimerWheel::Deadline deadline{boost::asio::use_service<TimerWheel>(context), [&] {
+                                      timed_out = true;
+                                      boost::beast::error_code ec;
+                                      stream.socket().cancel(ec);
+                                  }};
+    boost::beast::flat_buffer buffer;
+    std::array<std::byte, SESSION_ARENA_SIZE> arena_buffer;
+    std::pmr::monotonic_buffer_resource arena{arena_buffer.data(), arena_buffer.size()};
     while (true) {
-        boost::beast::flat_buffer buffer;
-        boost::beast::http::request<boost::beast::http::string_body> request;
-        auto result = co_await (boost::beast::http::async_read(stream, buffer, request, use_nothrow_awaitable) ||
-                                timeout(std::chrono::seconds(cfg.interval)));
-        if (result.index() == 1) {
-            SPDLOG_INFO("read timeout");
-            co_return;
+        // nothing of the previous request outlives its iteration
+        arena.release();
+        if (buffer.size() == 0) {
+            deadline.expiresAfter(idleTimeout(cfg));
+            auto [ec] = co_await stream.socket().async_wait(boost::asio::ip::tcp::socket::wait_read,
+                                                            use_nothrow_awaitable);
+            if (ec) {
+                SPDLOG_INFO("{}", timed_out ? "idle timeout" : ec.message());
+                co_return;
+            }
         }
-        auto [ec, bytes_transferred] = std::get<0>(result);
+        timed_out = false;
+        boost::beast::http::request_parser<ArenaStringBody, ArenaAllocator> parser{
+            std::piecewise_construct, std::make_tuple(ArenaAllocator{&arena}),
+            std::make_tuple(ArenaAllocator{&arena})};
+        deadline.expiresAfter(std::chrono::seconds(cfg.connection.header_timeout));
+        auto [ec, bytes_transferred] =
+            co_await boost::beast::http::async_read_header(stream, buffer, parser, use_nothrow_awaitable);
+        if (!ec && !parser.is_done()) {
+            deadline.expiresAfter(std::chrono::seconds(cfg.connection.body_timeout));
+            std::tie(ec, bytes_transferred) =
+                co_await boost::beast::http::async_read(stream, buffer, parser, use_nothrow_awaitable);
+        }
+        deadline.cancel();
         if (ec) {
-            SPDLOG_INFO("async_read: {}", ec.message());
+            SPDLOG_INFO("async_read: {}", timed_out ? "read timeout" : ec.message());
             co_return;
         }
+        auto request = parser.release();
         bool keep_alive = request.keep_alive();
         auto http_path = request.target();
         if (http_path.back() == '/')
             http_path.remove_suffix(1);
+        std::string_view api_key{request[boost::beast::http::field::authorization]};
+        if (request.target() != api_path) {
+            if (auto decision = rate_limiter->check(request.target(), "", ip_key, api_key); !decision.allowed) {
+                SPDLOG_INFO("[{}] rate limited on [{}]", remote_ip, request.target());
+                co_await sendTooManyRequests(stream, request, decision.retry_after);
+                co_return;
+            }
+        }
         if (http_path == cfg.chat_path) {
             auto html = createIndexHtml(std::format("{}/html/index.html", cfg.client_root_path), cfg);
             boost::beast::http::response<boost::beast::http::string_body> res{boost::beast::http::status::ok,
@@ -175,9 +362,14 @@ boost::asio::awaitable<void> startSession(boost::asio::ip::tcp::socket sock, Con
                 nlohmann::json data;
                 if (file.contains("chat.js")) {
                     auto format_string = [](const std::string& str) {
-                        std::regex pattern("/");
-                        std::string replacement = "\\/";
-                        return std::regex_replace(str, pattern, replacement);
+                        std::string escaped;
+                        escaped.reserve(str.size() * 2);
+                        for (auto c : str) {
+                            if (c == '/')
+                                escaped.push_back('\\');
+                            escaped.push_back(c);
+                        }
+                        return escaped;
                     };
                     data["chat_path"] = format_string(cfg.chat_path);
                     data["api_path"] = cfg.chat_path;
@@ -230,8 +422,39 @@ boost::asio::awaitable<void> startSession(boost::asio::ip::tcp::socket sock, Con
                 co_await sendHttpResponse(stream, request, boost::beast::http::status::bad_request);
                 co_return;
             }
+            if (auto decision = rate_limiter->check(request.target(), model, ip_key, api_key); !decision.allowed) {
+                SPDLOG_INFO("[{}] rate limited on model [{}]", remote_ip, model);
+                co_await sendTooManyRequests(stream, request, decision.retry_after);
+                co_return;
+            }
+            auto cache_key = response_cache->enabled(model) ? conversationKey(model, request_body) : std::nullopt;
+            if (cache_key) {
+                if (auto entry = response_cache->get(cache_key.value())) {
+                    SPDLOG_INFO("[{}] answered [{}] from cache", remote_ip, model);
+                    co_await sendCachedResponse(stream, request, entry.value(), cfg.response_cache);
+                    if (!keep_alive)
+                        co_return;
+                    continue;
+                }
+            }
+            // api keys aren't verified, a key only narrows the remote ip it comes from and is kept as a hash, the
+            // prefixes keep an Authorization value from passing for an ip
+            std::string client{std::format("ip:{}", remote_ip)};
+            if (!api_key.empty())
+                client.append(" key:").append(toHex(sha256Digest(api_key)));
+            // overwrites whatever the body claimed, upstream conversations are bound to it
+            request_body["client"] = client;
+            auto lane =
+                request["X-Priority"] == "batch" ? FairScheduler::Lane::Batch : FairScheduler::Lane::Interactive;
+            // flows are per remote ip, Authorization isn't verified and a value per request would be a flow per request
+            auto ticket = co_await fair_scheduler->acquire(remote_ip, lane, request.body().size() / 4096 + 1);
+            if (!ticket) {
+                co_await sendHttpResponse(stream, request, boost::beast::http::status::service_unavailable);
+                co_return;
+            }
 
-            boost::beast::http::response<boost::beast::http::buffer_body> res;
+            boost::beast::http::response<boost::beast::http::buffer_body, ArenaFields> res{
+                std::piecewise_construct, std::make_tuple(), std::make_tuple(ArenaAllocator{&arena})};
             res.result(boost::beast::http::status::ok);
             res.version(request.version());
             res.set(boost::beast::http::field::server, "CppFreeGpt");
@@ -240,15 +463,14 @@ boost::asio::awaitable<void> startSession(boost::asio::ip::tcp::socket sock, Con
             res.body().data = nullptr;
             res.body().more = true;
 
-            boost::beast::http::response_serializer<boost::beast::http::buffer_body, boost::beast::http::fields> sr{
-                res};
-            auto [ec, count] = co_await boost::beast::http::async_write_header(stream, sr, use_nothrow_awaitable);
-            if (ec) {
-                SPDLOG_ERROR("{}", ec.message());
-                co_return;
-            }
+            boost::beast::http::response_serializer<boost::beast::http::buffer_body, ArenaFields> sr{res};
             if (!gpt_function.contains(model)) {
                 SPDLOG_ERROR("Invalid request model: {}", model);
+                auto [ec, count] = co_await boost::beast::http::async_write_header(stream, sr, use_nothrow_awaitable);
+                if (ec) {
+                    SPDLOG_ERROR("{}", ec.message());
+                    co_return;
+                }
                 static std::string reject{"Invalid request model"};
                 res.body().data = reject.data();
                 res.body().size = reject.size();
@@ -256,15 +478,15 @@ boost::asio::awaitable<void> startSession(boost::asio::ip::tcp::socket sock, Con
                 std::tie(ec, count) = co_await boost::beast::http::async_write(stream, sr, use_nothrow_awaitable);
                 co_return;
             }
+            res.set("X-Provider", model);
             auto ch = std::make_shared<FreeGpt::Channel>(co_await boost::asio::this_coro::executor, 4096);
 
             boost::asio::co_spawn(
                 context,
-                [](auto ch, auto model, auto request_body) -> boost::asio::awaitable<void> {
-                    auto& func = gpt_function[model];
-                    co_await func(std::move(ch), std::move(request_body));
+                [](auto ch, auto model, auto request_body, auto ticket) -> boost::asio::awaitable<void> {
+                    co_await coalescer->run(model, gpt_function[model], std::move(ch), std::move(request_body));
                     co_return;
-                }(ch, std::move(model), std::move(request_body)),
+                }(ch, model, std::move(request_body), std::move(ticket.value())),
                 [](std::exception_ptr eptr) {
                     try {
                         if (eptr)
@@ -274,19 +496,80 @@ boost::asio::awaitable<void> startSession(boost::asio::ip::tcp::socket sock, Con
                     }
                 });
 
-            while (true) {
-                auto [ec, str] = co_await ch->async_receive(use_nothrow_awaitable);
-                if (ec) {
-                    break;
+            // the header waits for the first message, virtual models name the provider they settled on before it
+            auto [ec, str] = co_await ch->async_receive(use_nothrow_awaitable);
+            if (isServedBy(ec)) {
+                res.set("X-Provider", str);
+                std::tie(ec, str) = co_await ch->async_receive(use_nothrow_awaitable);
+            }
+            auto [write_ec, count] =
+                co_await boost::beast::http::async_write_header(stream, sr, use_nothrow_awaitable);
+            if (write_ec) {
+                SPDLOG_ERROR("{}", write_ec.message());
+                co_return;
+            }
+            // only complete answers without any provider error are cached
+            std::string answer;
+            bool cacheable = cache_key.has_value();
+            // chunks are cut wherever the network cut them, characters are only written out whole
+            Utf8Carry utf8;
+            // a provider error is shown to the user like the answer, the provider closes the channel after it
+            while (!ec || isProviderError(ec)) {
+                if (ec)
+                    cacheable = false;
+                str = utf8.feed(std::move(str));
+                if (cacheable)
+                    answer.append(str);
+                if (!str.empty()) {
+                    res.body().data = str.data();
+                    res.body().size = str.size();
+                    res.body().more = true;
+                    std::tie(write_ec, count) =
+                        co_await boost::beast::http::async_write(stream, sr, use_nothrow_awaitable);
                 }
+                std::tie(ec, str) = co_await ch->async_receive(use_nothrow_awaitable);
+            }
+            if (str = utf8.flush(); !str.empty()) {
+                cacheable = false;
                 res.body().data = str.data();
                 res.body().size = str.size();
                 res.body().more = true;
-                std::tie(ec, count) = co_await boost::beast::http::async_write(stream, sr, use_nothrow_awaitable);
+                std::tie(write_ec, count) =
+                    co_await boost::beast::http::async_write(stream, sr, use_nothrow_awaitable);
             }
             res.body().data = nullptr;
             res.body().more = false;
-            std::tie(ec, count) = co_await boost::beast::http::async_write(stream, sr, use_nothrow_awaitable);
+            std::tie(write_ec, count) = co_await boost::beast::http::async_write(stream, sr, use_nothrow_awaitable);
+            if (cacheable && !answer.empty())
+                response_cache->put(cache_key.value(), std::string{res["X-Provider"]}, std::move(answer));
+        } else if (request.target() == metrics_path) {
+            nlohmann::json metrics;
+            metrics["connections"] = connection_governor->metrics();
+            metrics["scheduler"] = fair_scheduler->metrics();
+            metrics["dispatcher"] = dispatcher->metrics();
+            metrics["circuit_breakers"] = circuit_breaker->metrics();
+            metrics["pacing"] = upstream_pacer->metrics();
+            metrics["coalescing"] = coalescer->metrics();
+            metrics["response_cache"] = response_cache->metrics();
+            metrics["credentials"] = credential_cache->metrics();
+            metrics["session_pools"] = session_pool_metrics();
+            metrics["conversation_sessions"] = conversation_sessions->metrics();
+            metrics["rate_limits"] = rate_limiter->metrics();
+            co_await sendJsonResponse(stream, request, metrics);
+        } else if (request.target() == admin_weights_path) {
+            if (!isAdminToken(api_key, cfg.admin_token)) {
+                SPDLOG_WARN("[{}] unauthorized admin request", remote_ip);
+                co_await sendHttpResponse(stream, request, boost::beast::http::status::forbidden);
+                co_return;
+            }
+            std::expected<void, std::string> ret;
+            if (request.method() == boost::beast::http::verb::post)
+                ret = dispatcher->setWeights(nlohmann::json::parse(request.body(), nullptr, false));
+            if (ret)
+                co_await sendJsonResponse(stream, request, dispatcher->weights());
+            else
+                co_await sendJsonResponse(stream, request, {{"error", ret.error()}},
+                                          boost::beast::http::status::bad_request);
         } else {
             SPDLOG_ERROR("bad_request: [{}], Expected path is: [{}]", request.target(), cfg.chat_path);
             co_await sendHttpResponse(stream, request, boost::beast::http::status::bad_request);
@@ -300,16 +583,18 @@ boost::asio::awaitable<void> startSession(boost::asio::ip::tcp::socket sock, Con
 
 boost::asio::awaitable<void> doSession(boost::asio::ip::tcp::acceptor& acceptor, IoContextPool& pool, Config& cfg) {
     for (;;) {
+        auto lease = co_await connection_governor->acquire();
         auto& context = pool.getIoContext();
         boost::asio::ip::tcp::socket socket(context);
         auto [ec] = co_await acceptor.async_accept(socket, use_nothrow_awaitable);
         if (ec) {
-            if (ec == boost::asio::error::operation_aborted)
+            if (!co_await connection_governor->onAcceptError(acceptor, ec))
                 break;
-            SPDLOG_ERROR("Accept failed, error: {}", ec.message());
             continue;
         }
-        boost::asio::co_spawn(context, startSession(std::move(socket), cfg, context), boost::asio::detached);
+        connection_governor->onAccepted();
+        boost::asio::co_spawn(context, startSession(std::move(socket), std::move(lease), cfg, context),
+                              boost::asio::detached);
     }
     co_return;
 }
@@ -328,8 +613,26 @@ int main(int argc, char** argv) {
 
     setEnvironment(cfg);
     auto [yaml_cfg_str, _] = yaml_cpp_struct::to_yaml(cfg);
+    routes = Routes{
+        .assets = std::format("{}{}", cfg.chat_path, ASSETS_PATH),
+        .api = std::format("{}{}", cfg.chat_path, API_PATH),
+        .metrics = std::format("{}{}", cfg.chat_path, METRICS_PATH),
+        .admin_weights = std::format("{}{}", cfg.chat_path, ADMIN_WEIGHTS_PATH),
+    };
+    SPDLOG_INFO("assets_path: [{}], api_path: [{}]", routes.assets, routes.api);
 
-    FreeGpt app{cfg};
+    credential_cache = std::make_shared<CredentialCache>(cfg.credentials);
+    conversation_sessions = std::make_shared<ConversationSessions>(cfg.conversation_sessions);
+    FreeGpt app{cfg, credential_cache, conversation_sessions};
+    session_pool_metrics = std::bind_front(&FreeGpt::sessionPoolMetrics, app);
+    fair_scheduler = std::make_unique<FairScheduler>(cfg.scheduler);
+    rate_limiter = std::make_unique<RateLimiter>(cfg.rate_limits);
+    ip_allow_list = std::make_unique<IpAllowList>(cfg.ip_white_list);
+    connection_governor = std::make_unique<ConnectionGovernor>(cfg.connection);
+    circuit_breaker = std::make_unique<CircuitBreaker>(cfg.circuit_breaker);
+    upstream_pacer = std::make_unique<UpstreamPacer>(cfg.pacing);
+    coalescer = std::make_unique<Coalescer>(cfg.coalescing);
+    response_cache = std::make_unique<ResponseCache>(cfg.response_cache);
 
     if (!cfg.api_key.empty())
         ADD_METHOD("gpt-3.5-turbo-stream-openai", FreeGpt::openAi);
@@ -353,6 +656,12 @@ int main(int argc, char** argv) {
     ADD_METHOD("gpt-3.5-turbo-stream-GeekGpt", FreeGpt::geekGpt);
     ADD_METHOD("llama2", FreeGpt::llama2);
 
+    dispatcher = std::make_unique<Dispatcher>(gpt_function, *circuit_breaker, *upstream_pacer);
+    dispatcher->instrumentProviders(cfg.token_timeouts);
+    dispatcher->addHedgedModels(cfg.hedged_models);
+    dispatcher->addFailoverModels(cfg.failover_models);
+    dispatcher->addRoutedModels(cfg.routed_models);
+
     SPDLOG_INFO("active provider:");
     for (auto& [provider, _] : gpt_function)
         SPDLOG_INFO("      {}", provider);
@@ -390,6 +699,23 @@ int main(int argc, char** argv) {
         acceptor.close();
         smph_signal_main_to_thread.release();
     });
+    // kill -HUP reloads the ip white list without dropping connections
+    boost::asio::signal_set reload_sigset(context, SIGHUP);
+    std::function<void()> wait_reload = [&] {
+        reload_sigset.async_wait([&](const boost::system::error_code& ec, int) {
+            if (ec)
+                return;
+            auto [new_config, error] = yaml_cpp_struct::from_yaml<Config>(argv[1]);
+            if (new_config) {
+                setIpWhiteList(new_config.value());
+                ip_allow_list->reload(new_config.value().ip_white_list);
+            } else {
+                SPDLOG_ERROR("reload config: {}", error);
+            }
+            wait_reload();
+        });
+    };
+    wait_reload();
     smph_signal_main_to_thread.acquire();
     SPDLOG_INFO("stoped ...");
     accept_pool.stop();
@@ -0,0 +1,481 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <limits>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "persistent_cache.h"
+
+namespace {
+
+constexpr uint32_t MAGIC = 0x46475043;
+constexpr std::string_view SEGMENT_PREFIX{"segment-"};
+constexpr std::string_view SEGMENT_SUFFIX{".dat"};
+
+// followed by key, provider and the compressed answer, records start 8 byte aligned
+struct RecordHeader {
+    uint32_t magic;
+    // crc32 of everything after the header
+    uint32_t checksum;
+    uint32_t key_size;
+    uint32_t provider_size;
+    uint32_t value_size;
+    uint32_t raw_size;
+    // unix seconds
+    int64_t expires_at;
+};
+static_assert(sizeof(RecordHeader) == 32);
+
+std::size_t align8(std::size_t size) {
+    return (size + 7) & ~std::size_t{7};
+}
+
+// records are located by 32 bit offsets, a segment can't be larger
+constexpr std::size_t MAX_SEGMENT_SIZE = std::numeric_limits<uint32_t>::max() & ~std::size_t{7};
+
+std::size_t segmentSize(std::size_t configured) {
+    if (configured <= MAX_SEGMENT_SIZE)
+        return align8(configured);
+    SPDLOG_WARN("segment_size {} is above the {} bytes a segment can address, clamped", configured, MAX_SEGMENT_SIZE);
+    return MAX_SEGMENT_SIZE;
+}
+
+std::size_t recordSize(const RecordHeader& header) {
+    return align8(sizeof(RecordHeader) + header.key_size + header.provider_size + header.value_size);
+}
+
+// the header at offset if a complete and intact record starts there
+std::optional<RecordHeader> readHeader(const char* data, std::size_t size, std::size_t offset) {
+    if (offset + sizeof(RecordHeader) > size)
+        return std::nullopt;
+    RecordHeader header;
+    std::memcpy(&header, data + offset, sizeof(header));
+    if (header.magic != MAGIC || offset + recordSize(header) > size)
+        return std::nullopt;
+    auto payload = reinterpret_cast<const Bytef*>(data + offset + sizeof(header));
+    auto payload_size = header.key_size + header.provider_size + header.value_size;
+    if (crc32(0, payload, payload_size) != header.checksum)
+        return std::nullopt;
+    return header;
+}
+
+std::string_view recordKey(const char* data, std::size_t offset, const RecordHeader& header) {
+    return {data + offset + sizeof(RecordHeader), header.key_size};
+}
+
+std::chrono::system_clock::time_point expiresAt(const RecordHeader& header) {
+    return std::chrono::system_clock::time_point{std::chrono::seconds(header.expires_at)};
+}
+
+}  // namespace
+
+PersistentCache::Segment::Segment(uint32_t id, int fd, const char* data, std::size_t size)
+    : id(id), fd(fd), data(data), size(size) {}
+
+PersistentCache::Segment::~Segment() {
+    munmap(const_cast<char*>(data), size);
+    ::close(fd);
+}
+
+PersistentCache::PersistentCache(std::string dir, std::size_t segment_size, std::size_t max_disk_bytes)
+    : m_dir(std::move(dir)), m_segment_size(segmentSize(segment_size)), m_max_disk_bytes(max_disk_bytes) {}
+
+PersistentCache::~PersistentCache() {
+    if (m_writer.joinable()) {
+        m_writer.request_stop();
+        m_writer.join();
+    }
+}
+
+bool PersistentCache::open() {
+    std::error_code ec;
+    std::filesystem::create_directories(m_dir, ec);
+    if (ec) {
+        SPDLOG_ERROR("create {}: {}", m_dir, ec.message());
+        return false;
+    }
+    std::vector<uint32_t> ids;
+    for (auto& item : std::filesystem::directory_iterator(m_dir, ec)) {
+        auto name = item.path().filename().string();
+        if (!name.starts_with(SEGMENT_PREFIX) || !name.ends_with(SEGMENT_SUFFIX))
+            continue;
+        std::string_view digits{name};
+        digits = digits.substr(SEGMENT_PREFIX.size(), digits.size() - SEGMENT_PREFIX.size() - SEGMENT_SUFFIX.size());
+        uint32_t id{0};
+        if (auto [ptr, errc] = std::from_chars(digits.data(), digits.data() + digits.size(), id);
+            errc == std::errc{} && ptr == digits.data() + digits.size())
+            ids.emplace_back(id);
+    }
+    std::ranges::sort(ids);
+    auto start = std::chrono::steady_clock::now();
+    std::lock_guard lk(m_mtx);
+    for (auto id : ids) {
+        auto segment = map(id, false);
+        if (!segment)
+            return false;
+        m_segments.emplace(id, segment);
+        scan(*segment);
+    }
+    if (m_segments.empty()) {
+        auto segment = map(0, true);
+        if (!segment)
+            return false;
+        m_segments.emplace(0, std::move(segment));
+    }
+    SPDLOG_INFO("response cache loaded {} answers from {} segments in {}ms", m_index.size(), m_segments.size(),
+                std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start)
+                    .count());
+    m_writer = std::jthread([this](std::stop_token stop_token) { run(stop_token); });
+    return true;
+}
+
+std::optional<PersistentCache::Record> PersistentCache::get(const std::string& key) {
+    auto hash = std::hash<std::string>{}(key);
+    std::shared_ptr<Segment> segment;
+    Location location;
+    {
+        std::lock_guard lk(m_mtx);
+        auto it = m_index.find(hash);
+        if (it == m_index.end())
+            return std::nullopt;
+        location = it->second;
+        segment = m_segments.at(location.segment);
+    }
+    // written once and never modified, the mapping stays valid while segment is held
+    RecordHeader header;
+    std::memcpy(&header, segment->data + location.offset, sizeof(header));
+    if (recordKey(segment->data, location.offset, header) != key)
+        return std::nullopt;
+    if (expiresAt(header) <= std::chrono::system_clock::now()) {
+        std::lock_guard lk(m_mtx);
+        if (indexed(hash, location.segment, location.offset))
+            forget(hash);
+        return std::nullopt;
+    }
+    auto provider = segment->data + location.offset + sizeof(header) + header.key_size;
+    auto value = reinterpret_cast<const Bytef*>(provider + header.provider_size);
+    Record record{std::string(provider, header.provider_size), std::string(header.raw_size, '\0'), expiresAt(header)};
+    uLongf raw_size = header.raw_size;
+    if (uncompress(reinterpret_cast<Bytef*>(record.answer.data()), &raw_size, value, header.value_size) != Z_OK ||
+        raw_size != header.raw_size) {
+        SPDLOG_ERROR("response cache: corrupt record in segment {}", location.segment);
+        return std::nullopt;
+    }
+    m_hits.fetch_add(1, std::memory_order_relaxed);
+    return record;
+}
+
+void PersistentCache::put(std::string key, std::string provider, std::shared_ptr<const std::string> answer,
+                          std::chrono::system_clock::time_point expires_at) {
+    {
+        std::lock_guard lk(m_queue_mtx);
+        if (m_queue.size() >= MAX_PENDING_WRITES) {
+            m_dropped_writes.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        m_queue.emplace_back(Write{std::move(key), std::move(provider), std::move(answer), expires_at});
+    }
+    m_cv.notify_one();
+}
+
+nlohmann::json PersistentCache::metrics() {
+    nlohmann::json metrics;
+    metrics["hits"] = m_hits.load(std::memory_order_relaxed);
+    metrics["compactions"] = m_compactions.load(std::memory_order_relaxed);
+    metrics["expirations"] = m_expirations.load(std::memory_order_relaxed);
+    metrics["evictions"] = m_evictions.load(std::memory_order_relaxed);
+    metrics["dropped_writes"] = m_dropped_writes.load(std::memory_order_relaxed);
+    std::lock_guard lk(m_mtx);
+    std::size_t bytes{0}, live{0};
+    for (auto& [_, segment] : m_segments) {
+        bytes += segment->tail;
+        live += segment->live;
+    }
+    metrics["entries"] = m_index.size();
+    metrics["segments"] = m_segments.size();
+    metrics["bytes"] = bytes;
+    metrics["live_bytes"] = live;
+    return metrics;
+}
+
+std::string PersistentCache::path(uint32_t segment) const {
+    return std::format("{}/{}{:08}{}", m_dir, SEGMENT_PREFIX, segment, SEGMENT_SUFFIX);
+}
+
+std::shared_ptr<PersistentCache::Segment> PersistentCache::map(uint32_t id, bool create) {
+    auto file = path(id);
+    int fd = ::open(file.c_str(), O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_EXCL : 0), 0644);
+    if (fd < 0) {
+        SPDLOG_ERROR("open {}: {}", file, strerror(errno));
+        return nullptr;
+    }
+    // segments have their full size from the start, appends land in pages that are mapped already
+    struct stat st{};
+    if ((create && ftruncate(fd, static_cast<off_t>(m_segment_size)) != 0) || fstat(fd, &st) != 0 ||
+        st.st_size == 0) {
+        SPDLOG_ERROR("size {}: {}", file, strerror(errno));
+        ::close(fd);
+        return nullptr;
+    }
+    // a larger file left by another build is read up to what the offsets reach
+    auto size = std::min(static_cast<std::size_t>(st.st_size), MAX_SEGMENT_SIZE);
+    auto data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        SPDLOG_ERROR("mmap {}: {}", file, strerror(errno));
+        ::close(fd);
+        return nullptr;
+    }
+    return std::make_shared<Segment>(id, fd, static_cast<const char*>(data), size);
+}
+
+void PersistentCache::scan(Segment& segment) {
+    auto now = std::chrono::system_clock::now();
+    std::size_t offset{0};
+    // a torn record at the end is overwritten by the next append
+    while (auto header = readHeader(segment.data, segment.size, offset)) {
+        auto size = recordSize(header.value());
+        if (expiresAt(header.value()) > now) {
+            auto hash = std::hash<std::string_view>{}(recordKey(segment.data, offset, header.value()));
+            forget(hash);
+            m_index.emplace(hash, Location{segment.id, static_cast<uint32_t>(offset)});
+            segment.live += size;
+        }
+        offset += size;
+    }
+    segment.tail = offset;
+}
+
+std::optional<PersistentCache::Location> PersistentCache::append(std::string_view record) {
+    if (record.size() > m_segment_size)
+        return std::nullopt;
+    // m_segments only changes on this thread, reading it needs no lock here
+    auto segment = m_segments.rbegin()->second;
+    if (segment->tail + record.size() > segment->size) {
+        segment = map(segment->id + 1, true);
+        if (!segment)
+            return std::nullopt;
+        std::lock_guard lk(m_mtx);
+        m_segments.emplace(segment->id, segment);
+    }
+    if (pwrite(segment->fd, record.data(), record.size(), static_cast<off_t>(segment->tail)) !=
+        static_cast<ssize_t>(record.size())) {
+        SPDLOG_ERROR("write {}: {}", path(segment->id), strerror(errno));
+        return std::nullopt;
+    }
+    Location location{segment->id, static_cast<uint32_t>(segment->tail)};
+    std::lock_guard lk(m_mtx);
+    segment->tail += record.size();
+    return location;
+}
+
+void PersistentCache::write(const Write& write) {
+    auto& [key, provider, answer, expires_at] = write;
+    uLongf value_size = compressBound(answer->size());
+    std::string value(value_size, '\0');
+    if (compress2(reinterpret_cast<Bytef*>(value.data()), &value_size, reinterpret_cast<const Bytef*>(answer->data()),
+                  answer->size(), Z_BEST_SPEED) != Z_OK)
+        return;
+    value.resize(value_size);
+
+    RecordHeader header{
+        .magic = MAGIC,
+        .checksum = 0,
+        .key_size = static_cast<uint32_t>(key.size()),
+        .provider_size = static_cast<uint32_t>(provider.size()),
+        .value_size = static_cast<uint32_t>(value.size()),
+        .raw_size = static_cast<uint32_t>(answer->size()),
+        .expires_at = std::chrono::duration_cast<std::chrono::seconds>(expires_at.time_since_epoch()).count(),
+    };
+    std::string record(recordSize(header), '\0');
+    auto payload = record.data() + sizeof(header);
+    std::memcpy(payload, key.data(), key.size());
+    std::memcpy(payload + key.size(), provider.data(), provider.size());
+    std::memcpy(payload + key.size() + provider.size(), value.data(), value.size());
+    header.checksum = crc32(0, reinterpret_cast<const Bytef*>(payload), key.size() + provider.size() + value.size());
+    std::memcpy(record.data(), &header, sizeof(header));
+
+    auto location = append(record);
+    if (!location)
+        return;
+    auto hash = std::hash<std::string>{}(key);
+    std::lock_guard lk(m_mtx);
+    forget(hash);
+    m_index.emplace(hash, location.value());
+    m_segments.at(location->segment)->live += record.size();
+}
+
+void PersistentCache::forget(uint64_t hash) {
+    auto it = m_index.find(hash);
+    if (it == m_index.end())
+        return;
+    if (auto segment = m_segments.find(it->second.segment); segment != m_segments.end()) {
+        RecordHeader header;
+        std::memcpy(&header, segment->second->data + it->second.offset, sizeof(header));
+        segment->second->live -= recordSize(header);
+    }
+    m_index.erase(it);
+}
+
+bool PersistentCache::indexed(uint64_t hash, uint32_t segment, std::size_t offset) const {
+    auto it = m_index.find(hash);
+    return it != m_index.end() && it->second.segment == segment && it->second.offset == offset;
+}
+
+std::vector<std::pair<uint64_t, uint32_t>> PersistentCache::records(const Segment& segment, bool expired_only) const {
+    // a sealed segment is never written again, every record up to tail was checked when it was scanned or appended
+    auto now = std::chrono::system_clock::now();
+    std::vector<std::pair<uint64_t, uint32_t>> records;
+    for (std::size_t offset{0}; offset < segment.tail;) {
+        RecordHeader header;
+        std::memcpy(&header, segment.data + offset, sizeof(header));
+        if (!expired_only || expiresAt(header) <= now)
+            records.emplace_back(std::hash<std::string_view>{}(recordKey(segment.data, offset, header)),
+                                 static_cast<uint32_t>(offset));
+        offset += recordSize(header);
+    }
+    return records;
+}
+
+void PersistentCache::expire(const Segment& segment) {
+    // answers nobody asks for again would otherwise stay live until a restart
+    auto expired = records(segment, true);
+    if (expired.empty())
+        return;
+    std::lock_guard lk(m_mtx);
+    for (auto [hash, offset] : expired) {
+        if (!indexed(hash, segment.id, offset))
+            continue;
+        forget(hash);
+        m_expirations.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void PersistentCache::evict() {
+    if (m_max_disk_bytes == 0)
+        return;
+    while (true) {
+        std::shared_ptr<Segment> segment;
+        {
+            // segments have their full size on disk from the start
+            std::lock_guard lk(m_mtx);
+            std::size_t bytes{0};
+            for (auto& [_, item] : m_segments)
+                bytes += item->size;
+            if (bytes <= m_max_disk_bytes || m_segments.size() < 2)
+                return;
+            segment = m_segments.begin()->second;
+        }
+        auto dropped = records(*segment, false);
+        std::lock_guard lk(m_mtx);
+        std::size_t answers{0};
+        for (auto [hash, offset] : dropped) {
+            if (indexed(hash, segment->id, offset)) {
+                forget(hash);
+                ++answers;
+            }
+        }
+        m_segments.erase(segment->id);
+        std::error_code ec;
+        std::filesystem::remove(path(segment->id), ec);
+        m_evictions.fetch_add(1, std::memory_order_relaxed);
+        SPDLOG_INFO("response cache: evicted segment {} with {} answers, over {} bytes", segment->id, answers,
+                    m_max_disk_bytes);
+    }
+}
+
+void PersistentCache::compact(std::stop_token stop_token) {
+    std::vector<std::shared_ptr<Segment>> sealed;
+    {
+        std::lock_guard lk(m_mtx);
+        // the active segment is the last one, never compacted
+        for (auto it = m_segments.begin(); std::next(it) != m_segments.end(); ++it)
+            sealed.emplace_back(it->second);
+    }
+    for (auto& item : sealed) {
+        if (stop_token.stop_requested())
+            return;
+        expire(*item);
+    }
+    evict();
+    std::shared_ptr<Segment> segment;
+    {
+        std::lock_guard lk(m_mtx);
+        for (auto it = m_segments.begin(); it != m_segments.end() && std::next(it) != m_segments.end(); ++it) {
+            if (it->second->live * 2 < it->second->tail) {
+                segment = it->second;
+                break;
+            }
+        }
+    }
+    if (!segment)
+        return;
+    auto now = std::chrono::system_clock::now();
+    std::size_t moved{0};
+    for (std::size_t offset{0}; offset < segment->tail && !stop_token.stop_requested();) {
+        auto header = readHeader(segment->data, segment->size, offset);
+        if (!header)
+            break;
+        auto start = offset;
+        auto size = recordSize(header.value());
+        auto hash = std::hash<std::string_view>{}(recordKey(segment->data, start, header.value()));
+        offset += size;
+        std::unique_lock lk(m_mtx);
+        if (!indexed(hash, segment->id, start))
+            continue;
+        if (expiresAt(header.value()) <= now) {
+            forget(hash);
+            continue;
+        }
+        lk.unlock();
+        auto location = append({segment->data + start, size});
+        lk.lock();
+        // a reader may have dropped it in the meantime, the copy is dead then
+        if (!location || !indexed(hash, segment->id, start))
+            continue;
+        segment->live -= size;
+        m_segments.at(location->segment)->live += size;
+        m_index[hash] = location.value();
+        ++moved;
+    }
+    if (stop_token.stop_requested())
+        return;
+    std::lock_guard lk(m_mtx);
+    if (segment->live != 0)
+        return;
+    m_segments.erase(segment->id);
+    std::error_code ec;
+    std::filesystem::remove(path(segment->id), ec);
+    m_compactions.fetch_add(1, std::memory_order_relaxed);
+    SPDLOG_INFO("response cache: compacted segment {}, {} answers moved", segment->id, moved);
+}
+
+void PersistentCache::run(std::stop_token stop_token) {
+    auto next_compaction = std::chrono::steady_clock::now() + COMPACTION_INTERVAL;
+    while (true) {
+        std::vector<Write> writes;
+        {
+            std::unique_lock lk(m_queue_mtx);
+            m_cv.wait_until(lk, stop_token, next_compaction, [this] { return !m_queue.empty(); });
+            writes.swap(m_queue);
+        }
+        // what was queued before the stop is still written
+        for (auto& item : writes)
+            write(item);
+        if (stop_token.stop_requested())
+            return;
+        if (std::chrono::steady_clock::now() < next_compaction)
+            continue;
+        compact(stop_token);
+        next_compaction = std::chrono::steady_clock::now() + COMPACTION_INTERVAL;
+    }
+}
@@ -0,0 +1,50 @@
+#include "provider_stats.h"
+
+void ProviderStats::recordSuccess(const std::string& provider, std::chrono::milliseconds ttft, double tokens_per_sec) {
+    std::lock_guard lk(m_mtx);
+    auto [it, inserted] = m_snapshots.try_emplace(provider);
+    auto& snapshot = it->second;
+    auto ttft_ms = static_cast<double>(ttft.count());
+    if (inserted || snapshot.requests == snapshot.failures) {
+        snapshot.ttft_ms = ttft_ms;
+        snapshot.tokens_per_sec = tokens_per_sec;
+    } else {
+        snapshot.ttft_ms += ALPHA * (ttft_ms - snapshot.ttft_ms);
+        snapshot.tokens_per_sec += ALPHA * (tokens_per_sec - snapshot.tokens_per_sec);
+    }
+    snapshot.success_rate += ALPHA * (1 - snapshot.success_rate);
+    ++snapshot.requests;
+}
+
+void ProviderStats::recordFailure(const std::string& provider, bool timed_out) {
+    std::lock_guard lk(m_mtx);
+    auto& snapshot = m_snapshots[provider];
+    snapshot.success_rate -= ALPHA * snapshot.success_rate;
+    ++snapshot.requests;
+    ++snapshot.failures;
+    if (timed_out)
+        ++snapshot.timeouts;
+}
+
+std::optional<ProviderStats::Snapshot> ProviderStats::get(const std::string& provider) {
+    std::lock_guard lk(m_mtx);
+    if (auto it = m_snapshots.find(provider); it != m_snapshots.end())
+        return it->second;
+    return std::nullopt;
+}
+
+nlohmann::json ProviderStats::metrics() {
+    std::lock_guard lk(m_mtx);
+    nlohmann::json metrics = nlohmann::json::object();
+    for (auto& [provider, snapshot] : m_snapshots) {
+        metrics[provider] = {
+            {"ttft_ms", snapshot.ttft_ms},
+            {"tokens_per_sec", snapshot.tokens_per_sec},
+            {"success_rate", snapshot.success_rate},
+            {"requests", snapshot.requests},
+            {"failures", snapshot.failures},
+            {"timeouts", snapshot.timeouts},
+        };
+    }
+    return metrics;
+}
@@ -0,0 +1,122 @@
+#include <algorithm>
+#include <bit>
+#include <mutex>
+#include <thread>
+
+#include <spdlog/spdlog.h>
+
+#include "rate_limiter.h"
+
+namespace {
+
+int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+}  // namespace
+
+RateLimiter::RateLimiter(const std::vector<RateLimitRule>& rules)
+    : m_shard_mask(std::bit_ceil(std::max(std::thread::hardware_concurrency(), 1u)) - 1) {
+    for (auto& cfg : rules) {
+        if (cfg.rate <= 0) {
+            SPDLOG_WARN("ignore rate limit rule with rate {} for [{}] [{}]", cfg.rate, cfg.path, cfg.model);
+            continue;
+        }
+        auto rule = std::make_unique<Rule>();
+        rule->cfg = cfg;
+        rule->interval_ns = static_cast<int64_t>(1e9 / cfg.rate);
+        rule->burst_ns = rule->interval_ns * static_cast<int64_t>(std::max<std::size_t>(cfg.burst, 1));
+        rule->shards = std::make_unique<Shard[]>(m_shard_mask + 1);
+        SPDLOG_INFO("rate limit path: [{}], model: [{}], rate: {}/s, burst: {}", cfg.path, cfg.model, cfg.rate,
+                    cfg.burst);
+        m_rules.emplace_back(std::move(rule));
+    }
+}
+
+RateLimiter::Decision RateLimiter::check(std::string_view path, std::string_view model, std::string_view ip,
+                                         std::string_view api_key) {
+    auto rule = match(path, model);
+    if (rule == nullptr)
+        return {};
+    auto now = nowNs();
+    auto decision = consume(*rule, 0, ip, now);
+    if (decision.allowed && !api_key.empty()) {
+        decision = consume(*rule, 1, api_key, now);
+        // a request the api key bucket rejects doesn't count against the ip either
+        if (!decision.allowed)
+            refund(*rule, 0, ip);
+    }
+    if (decision.allowed)
+        rule->allowed.fetch_add(1, std::memory_order_relaxed);
+    else
+        rule->rejected.fetch_add(1, std::memory_order_relaxed);
+    return decision;
+}
+
+nlohmann::json RateLimiter::metrics() const {
+    nlohmann::json metrics = nlohmann::json::array();
+    for (auto& rule : m_rules) {
+        metrics.push_back({
+            {"path", rule->cfg.path},
+            {"model", rule->cfg.model},
+            {"allowed", rule->allowed.load(std::memory_order_relaxed)},
+            {"rejected", rule->rejected.load(std::memory_order_relaxed)},
+        });
+    }
+    return metrics;
+}
+
+RateLimiter::Rule* RateLimiter::match(std::string_view path, std::string_view model) {
+    for (auto& rule : m_rules) {
+        if (!rule->cfg.path.empty() && !path.starts_with(rule->cfg.path))
+            continue;
+        if (!rule->cfg.model.empty() && model != rule->cfg.model)
+            continue;
+        return rule.get();
+    }
+    return nullptr;
+}
+
+RateLimiter::Decision RateLimiter::consume(Rule& rule, std::size_t kind, std::string_view key, int64_t now) {
+    auto& shard = rule.shards[std::hash<std::string_view>{}(key) & m_shard_mask];
+    auto& buckets = shard.buckets[kind];
+    auto try_consume = [&](Bucket& bucket) -> Decision {
+        auto tat = bucket.tat.load(std::memory_order_relaxed);
+        while (true) {
+            auto new_tat = std::max(tat, now) + rule.interval_ns;
+            if (new_tat - now > rule.burst_ns)
+                return {false, std::chrono::ceil<std::chrono::milliseconds>(
+                                   std::chrono::nanoseconds(new_tat - now - rule.burst_ns))};
+            if (bucket.tat.compare_exchange_weak(tat, new_tat, std::memory_order_relaxed))
+                return {};
+        }
+    };
+    {
+        std::shared_lock lk(shard.mtx);
+        if (auto it = buckets.find(key); it != buckets.end())
+            return try_consume(it->second);
+    }
+    std::unique_lock lk(shard.mtx);
+    if (buckets.size() >= shard.sweep_threshold) {
+        sweep(buckets, now);
+        // keep sweeping amortized when most keys are still active
+        if (buckets.size() * 2 > shard.sweep_threshold)
+            shard.sweep_threshold *= 2;
+    }
+    auto [it, _] = buckets.try_emplace(std::string{key});
+    return try_consume(it->second);
+}
+
+void RateLimiter::refund(Rule& rule, std::size_t kind, std::string_view key) {
+    auto& shard = rule.shards[std::hash<std::string_view>{}(key) & m_shard_mask];
+    std::shared_lock lk(shard.mtx);
+    // swept in the meantime means it was full again, nothing to give back
+    if (auto it = shard.buckets[kind].find(key); it != shard.buckets[kind].end())
+        it->second.tat.fetch_sub(rule.interval_ns, std::memory_order_relaxed);
+}
+
+void RateLimiter::sweep(BucketMap& buckets, int64_t now) {
+    // a bucket whose arrival time has passed is full again, forgetting it is equivalent to keeping it
+    std::erase_if(buckets, [now](auto& item) { return item.second.tat.load(std::memory_order_relaxed) <= now; });
+}
@@ -0,0 +1,97 @@
+#include <spdlog/spdlog.h>
+
+#include "response_cache.h"
+
+ResponseCache::ResponseCache(const ResponseCacheConfig& cfg)
+    : m_cfg(cfg), m_models(cfg.models.begin(), cfg.models.end()) {
+    if (m_cfg.persist_dir.empty() || m_models.empty())
+        return;
+    m_store = std::make_unique<PersistentCache>(m_cfg.persist_dir, m_cfg.segment_size, m_cfg.max_disk_bytes);
+    if (!m_store->open()) {
+        SPDLOG_ERROR("response cache stays in memory, {} is not usable", m_cfg.persist_dir);
+        m_store.reset();
+    }
+}
+
+std::optional<ResponseCache::Entry> ResponseCache::get(const std::string& key) {
+    {
+        std::lock_guard lk(m_mtx);
+        auto it = m_index.find(key);
+        if (it != m_index.end() && it->second->expires_at > std::chrono::steady_clock::now()) {
+            m_items.splice(m_items.begin(), m_items, it->second);
+            m_hits.fetch_add(1, std::memory_order_relaxed);
+            return it->second->entry;
+        }
+        if (it != m_index.end()) {
+            erase(it->second);
+            m_expired.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    if (m_store) {
+        if (auto record = m_store->get(key)) {
+            // the store keeps wall clock expiry, it survives restarts
+            auto ttl = record->expires_at - std::chrono::system_clock::now();
+            Entry entry{std::move(record->provider), std::make_shared<const std::string>(std::move(record->answer))};
+            std::lock_guard lk(m_mtx);
+            insert(key, entry, std::chrono::steady_clock::now() +
+                                   std::chrono::duration_cast<std::chrono::steady_clock::duration>(ttl));
+            m_hits.fetch_add(1, std::memory_order_relaxed);
+            return entry;
+        }
+    }
+    m_misses.fetch_add(1, std::memory_order_relaxed);
+    return std::nullopt;
+}
+
+void ResponseCache::put(const std::string& key, std::string provider, std::string answer) {
+    Entry entry{std::move(provider), std::make_shared<const std::string>(std::move(answer))};
+    // the store shares the answer and writes it on its own thread, the caller is on the io thread
+    if (m_store)
+        m_store->put(key, entry.provider, entry.answer,
+                     std::chrono::system_clock::now() + std::chrono::seconds(m_cfg.ttl));
+    std::lock_guard lk(m_mtx);
+    insert(key, std::move(entry), std::chrono::steady_clock::now() + std::chrono::seconds(m_cfg.ttl));
+}
+
+nlohmann::json ResponseCache::metrics() {
+    nlohmann::json metrics;
+    auto hits = m_hits.load(std::memory_order_relaxed);
+    auto misses = m_misses.load(std::memory_order_relaxed);
+    metrics["hits"] = hits;
+    metrics["misses"] = misses;
+    metrics["hit_rate"] = hits + misses == 0 ? 0.0 : static_cast<double>(hits) / static_cast<double>(hits + misses);
+    metrics["evictions"] = m_evictions.load(std::memory_order_relaxed);
+    metrics["expired"] = m_expired.load(std::memory_order_relaxed);
+    std::lock_guard lk(m_mtx);
+    metrics["entries"] = m_items.size();
+    metrics["bytes"] = m_bytes;
+    if (m_store)
+        metrics["persistent"] = m_store->metrics();
+    return metrics;
+}
+
+void ResponseCache::insert(const std::string& key, Entry entry, std::chrono::steady_clock::time_point expires_at) {
+    auto bytes = key.size() + entry.provider.size() + entry.answer->size();
+    if (bytes > m_cfg.max_bytes)
+        return;
+    if (auto it = m_index.find(key); it != m_index.end())
+        erase(it->second);
+    while (m_bytes + bytes > m_cfg.max_bytes && !m_items.empty()) {
+        erase(std::prev(m_items.end()));
+        m_evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+    m_items.emplace_front(Item{
+        .key = key,
+        .entry = std::move(entry),
+        .expires_at = expires_at,
+        .bytes = bytes,
+    });
+    m_index.emplace(m_items.front().key, m_items.begin());
+    m_bytes += bytes;
+}
+
+void ResponseCache::erase(std::list<Item>::iterator it) {
+    m_bytes -= it->bytes;
+    m_index.erase(it->key);
+    m_items.erase(it);
+}
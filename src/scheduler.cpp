@@ -0,0 +1,172 @@
+#include <algorithm>
+#include <utility>
+
+#include <spdlog/spdlog.h>
+#include <boost/asio/experimental/awaitable_operators.hpp>
+
+#include "scheduler.h"
+
+FairScheduler::Ticket::Ticket(FairScheduler* scheduler, Lane lane) : m_scheduler(scheduler), m_lane(lane) {}
+
+FairScheduler::Ticket::Ticket(Ticket&& other) noexcept
+    : m_scheduler(std::exchange(other.m_scheduler, nullptr)), m_lane(other.m_lane) {}
+
+FairScheduler::Ticket& FairScheduler::Ticket::operator=(Ticket&& other) noexcept {
+    if (this != &other) {
+        if (m_scheduler)
+            m_scheduler->release(m_lane);
+        m_scheduler = std::exchange(other.m_scheduler, nullptr);
+        m_lane = other.m_lane;
+    }
+    return *this;
+}
+
+FairScheduler::Ticket::~Ticket() {
+    if (m_scheduler)
+        m_scheduler->release(m_lane);
+}
+
+FairScheduler::FairScheduler(const SchedulerConfig& cfg)
+    : m_capacity(cfg.max_concurrent_requests),
+      m_max_queued(cfg.max_queued_requests),
+      m_quantum(std::max<std::size_t>(cfg.quantum, 1)),
+      m_batch_share(std::max<std::size_t>(cfg.batch_lane_share, 1)),
+      m_queue_timeout(cfg.queue_timeout) {}
+
+boost::asio::awaitable<std::optional<FairScheduler::Ticket>> FairScheduler::acquire(std::string client, Lane lane,
+                                                                                  std::size_t cost) {
+    auto& state = m_lanes[std::to_underlying(lane)];
+    auto executor = co_await boost::asio::this_coro::executor;
+    std::unique_lock lk(m_mtx);
+    if (m_capacity == 0) {
+        ++state.dispatched;
+        co_return Ticket{};
+    }
+    auto queued = m_lanes[0].queued + m_lanes[1].queued;
+    if (m_running < m_capacity && queued == 0) {
+        ++m_running;
+        ++state.running;
+        ++state.dispatched;
+        co_return Ticket{this, lane};
+    }
+    if (queued >= m_max_queued) {
+        ++state.rejected;
+        SPDLOG_WARN("scheduler queue is full, reject [{}]", client);
+        co_return std::nullopt;
+    }
+    auto waiter = std::make_shared<Waiter>(std::make_shared<AsyncSignal>(executor), std::max<std::size_t>(cost, 1),
+                                           std::chrono::steady_clock::now());
+    auto [it, inserted] = state.flows.try_emplace(client);
+    if (inserted)
+        state.round.emplace_back(client);
+    it->second.waiters.emplace_back(waiter);
+    ++state.queued;
+    lk.unlock();
+
+    using namespace boost::asio::experimental::awaitable_operators;
+    co_await (waiter->signal->wait() || timeout(m_queue_timeout));
+
+    lk.lock();
+    if (waiter->granted)
+        co_return Ticket{this, lane};
+    removeLocked(state, client, waiter);
+    ++state.expired;
+    SPDLOG_WARN("[{}] waited more than {}s in scheduler queue", client, m_queue_timeout.count());
+    co_return std::nullopt;
+}
+
+nlohmann::json FairScheduler::metrics() {
+    std::lock_guard lk(m_mtx);
+    nlohmann::json metrics;
+    metrics["capacity"] = m_capacity;
+    metrics["running"] = m_running;
+    constexpr std::array<std::string_view, 2> names{"interactive", "batch"};
+    for (std::size_t i = 0; i < m_lanes.size(); ++i) {
+        auto& state = m_lanes[i];
+        metrics["lanes"][names[i]] = {
+            {"queued", state.queued},           {"clients", state.flows.size()},
+            {"running", state.running},         {"dispatched", state.dispatched},
+            {"rejected", state.rejected},       {"expired", state.expired},
+            {"wait_ms_avg", state.wait_ms_avg}, {"wait_ms_max", state.wait_ms_max},
+        };
+    }
+    return metrics;
+}
+
+void FairScheduler::release(Lane lane) {
+    std::lock_guard lk(m_mtx);
+    --m_running;
+    --m_lanes[std::to_underlying(lane)].running;
+    dispatchLocked();
+}
+
+void FairScheduler::dispatchLocked() {
+    auto& interactive = m_lanes[std::to_underlying(Lane::Interactive)];
+    auto& batch = m_lanes[std::to_underlying(Lane::Batch)];
+    while (m_running < m_capacity && (interactive.queued > 0 || batch.queued > 0)) {
+        LaneState* state = &interactive;
+        if (interactive.queued == 0 || (batch.queued > 0 && m_interactive_streak >= m_batch_share)) {
+            state = &batch;
+            m_interactive_streak = 0;
+        } else {
+            ++m_interactive_streak;
+        }
+        auto waiter = popLocked(*state);
+        waiter->granted = true;
+        ++m_running;
+        ++state->running;
+        ++state->dispatched;
+        recordWaitLocked(*state, waiter->enqueue_time);
+        waiter->signal->notify();
+    }
+}
+
+std::shared_ptr<FairScheduler::Waiter> FairScheduler::popLocked(LaneState& state) {
+    auto rotate = [&] {
+        state.round.emplace_back(std::move(state.round.front()));
+        state.round.pop_front();
+    };
+    while (true) {
+        auto it = state.flows.find(state.round.front());
+        auto& flow = it->second;
+        if (flow.deficit < flow.waiters.front()->cost) {
+            flow.deficit += m_quantum;
+            if (flow.deficit < flow.waiters.front()->cost) {
+                rotate();
+                continue;
+            }
+        }
+        auto waiter = std::move(flow.waiters.front());
+        flow.waiters.pop_front();
+        flow.deficit -= waiter->cost;
+        --state.queued;
+        if (flow.waiters.empty()) {
+            state.flows.erase(it);
+            state.round.pop_front();
+        } else if (flow.deficit < flow.waiters.front()->cost) {
+            rotate();
+        }
+        return waiter;
+    }
+}
+
+void FairScheduler::removeLocked(LaneState& state, const std::string& client, const std::shared_ptr<Waiter>& waiter) {
+    auto it = state.flows.find(client);
+    if (it == state.flows.end())
+        return;
+    auto& waiters = it->second.waiters;
+    if (auto pos = std::ranges::find(waiters, waiter); pos != waiters.end()) {
+        waiters.erase(pos);
+        --state.queued;
+    }
+    if (waiters.empty()) {
+        state.flows.erase(it);
+        std::erase(state.round, client);
+    }
+}
+
+void FairScheduler::recordWaitLocked(LaneState& state, std::chrono::steady_clock::time_point enqueue_time) {
+    auto wait_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - enqueue_time).count();
+    state.wait_ms_avg = state.wait_ms_avg == 0 ? wait_ms : state.wait_ms_avg * 0.9 + wait_ms * 0.1;
+    state.wait_ms_max = std::max(state.wait_ms_max, wait_ms);
+}
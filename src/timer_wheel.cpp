@@ -0,0 +1,101 @@
+#include "timer_wheel.h"
+
+TimerWheel::Deadline::Deadline(TimerWheel& wheel, std::function<void()> on_expire)
+    : m_wheel(wheel), m_on_expire(std::move(on_expire)) {}
+
+TimerWheel::Deadline::~Deadline() {
+    cancel();
+}
+
+void TimerWheel::Deadline::expiresAfter(Clock::duration duration) {
+    cancel();
+    auto now = Clock::now();
+    // a sleeping wheel is empty, catch its clock up before inserting relative to it
+    if (!m_wheel.m_ticking)
+        m_wheel.m_current_tick = std::max(m_wheel.m_current_tick, m_wheel.toTick(now));
+    // round up so a deadline never fires early
+    m_expiry_tick = std::max(m_wheel.toTick(now + duration) + 1, m_wheel.m_current_tick + 1);
+    m_wheel.insert(*this);
+    ++m_wheel.m_armed;
+    if (!m_wheel.m_ticking) {
+        m_wheel.m_ticking = true;
+        m_wheel.scheduleTick();
+    }
+}
+
+void TimerWheel::Deadline::cancel() {
+    if (!is_linked())
+        return;
+    unlink();
+    --m_wheel.m_armed;
+}
+
+TimerWheel::TimerWheel(boost::asio::io_context& context)
+    : boost::asio::execution_context::service(context), m_timer(context), m_start(Clock::now()) {}
+
+void TimerWheel::shutdown() {
+    for (auto& level : m_slots)
+        for (auto& slot : level)
+            slot.clear();
+    m_armed = 0;
+    m_timer.cancel();
+}
+
+uint64_t TimerWheel::toTick(Clock::time_point time_point) const {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(time_point - m_start) / TICK;
+}
+
+void TimerWheel::insert(Deadline& deadline) {
+    auto delta = deadline.m_expiry_tick - m_current_tick;
+    std::size_t level = 0;
+    while (level + 1 < LEVELS && delta >= (uint64_t{1} << (SLOT_BITS * (level + 1))))
+        ++level;
+    auto slot = (deadline.m_expiry_tick >> (SLOT_BITS * level)) & (SLOTS - 1);
+    m_slots[level][slot].push_back(deadline);
+}
+
+void TimerWheel::step() {
+    ++m_current_tick;
+    // pull the next block of every coarser level down once the finer level wraps
+    for (std::size_t level = 1; level < LEVELS; ++level) {
+        if ((m_current_tick & ((uint64_t{1} << (SLOT_BITS * level)) - 1)) != 0)
+            break;
+        Slot cascade;
+        cascade.splice(cascade.end(), m_slots[level][(m_current_tick >> (SLOT_BITS * level)) & (SLOTS - 1)]);
+        while (!cascade.empty()) {
+            auto& deadline = cascade.front();
+            cascade.pop_front();
+            insert(deadline);
+        }
+    }
+    Slot expired;
+    expired.splice(expired.end(), m_slots[0][m_current_tick & (SLOTS - 1)]);
+    while (!expired.empty()) {
+        auto& deadline = expired.front();
+        expired.pop_front();
+        --m_armed;
+        // the callback may re-arm or destroy the deadline
+        deadline.m_on_expire();
+    }
+}
+
+void TimerWheel::onTick() {
+    auto target = toTick(Clock::now());
+    while (m_current_tick < target && m_armed > 0)
+        step();
+    if (m_armed == 0) {
+        // nothing is armed, the wheel sleeps until the next expiresAfter()
+        m_ticking = false;
+        return;
+    }
+    scheduleTick();
+}
+
+void TimerWheel::scheduleTick() {
+    m_timer.expires_at(m_start + TICK * (m_current_tick + 1));
+    m_timer.async_wait([this](const boost::system::error_code& ec) {
+        if (ec)
+            return;
+        onTick();
+    });
+}
@@ -0,0 +1,58 @@
+#include "token_extractor.h"
+
+TokenPattern::TokenPattern(std::vector<Field> fields) {
+    m_matchers.reserve(fields.size());
+    for (auto& [marker, terminator] : fields) {
+        std::vector<std::size_t> fallback(marker.size(), 0);
+        for (std::size_t i = 1, k = 0; i < marker.size(); ++i) {
+            while (k > 0 && marker[i] != marker[k])
+                k = fallback[k - 1];
+            if (marker[i] == marker[k])
+                ++k;
+            fallback[i] = k;
+        }
+        m_matchers.emplace_back(Matcher{std::move(marker), terminator, std::move(fallback)});
+    }
+}
+
+TokenExtractor::TokenExtractor(const TokenPattern& pattern)
+    : m_pattern(pattern), m_values(pattern.m_matchers.size()) {}
+
+bool TokenExtractor::feed(std::string_view data) {
+    std::size_t pos = 0;
+    while (pos < data.size() && !done()) {
+        auto& [marker, terminator, fallback] = m_pattern.m_matchers[m_field];
+        auto& value = m_values[m_field];
+        if (m_capturing) {
+            auto end = data.find(terminator, pos);
+            value.append(data.substr(pos, end - pos));
+            if (end == std::string_view::npos) {
+                if (value.size() > max_value_size) {
+                    value.clear();
+                    m_capturing = false;
+                }
+                return false;
+            }
+            pos = end + 1;
+            m_capturing = false;
+            ++m_field;
+            continue;
+        }
+        if (m_matched == 0) {
+            // nothing of the marker is pending, skip straight to its next first byte
+            pos = data.find(marker.front(), pos);
+            if (pos == std::string_view::npos)
+                return false;
+        }
+        auto c = data[pos++];
+        while (m_matched > 0 && c != marker[m_matched])
+            m_matched = fallback[m_matched - 1];
+        if (c == marker[m_matched])
+            ++m_matched;
+        if (m_matched == marker.size()) {
+            m_matched = 0;
+            m_capturing = true;
+        }
+    }
+    return done();
+}
@@ -0,0 +1,91 @@
+#include <algorithm>
+
+#include <spdlog/spdlog.h>
+#include <boost/asio/as_tuple.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/use_awaitable.hpp>
+
+#include "upstream_pacer.h"
+
+UpstreamPacer::UpstreamPacer(const PacingConfig& cfg) : m_cfg(cfg) {
+    m_cfg.min_rate = std::max(m_cfg.min_rate, 0.01);
+    m_cfg.max_rate = std::max(m_cfg.max_rate, m_cfg.min_rate);
+}
+
+boost::asio::awaitable<bool> UpstreamPacer::acquire(const std::string& provider) {
+    auto now = Clock::now();
+    Clock::time_point slot;
+    {
+        std::lock_guard lk(m_mtx);
+        auto& pace = m_paces[provider];
+        if (now - pace.window_start >= RATE_WINDOW) {
+            auto seconds = std::chrono::duration<double>(now - pace.window_start).count();
+            pace.arrival_rate = pace.window_requests / seconds;
+            pace.window_start = now;
+            pace.window_requests = 0;
+        }
+        ++pace.window_requests;
+        slot = std::max(now, pace.next_slot);
+        if (slot - now > std::chrono::seconds(m_cfg.max_wait)) {
+            ++pace.rejected;
+            co_return false;
+        }
+        if (pace.rate)
+            pace.next_slot = slot + std::chrono::duration_cast<Clock::duration>(
+                                        std::chrono::duration<double>(1 / pace.rate.value()));
+        if (slot > now)
+            ++pace.delayed;
+    }
+    if (slot > now) {
+        boost::asio::steady_timer timer(co_await boost::asio::this_coro::executor, slot);
+        [[maybe_unused]] auto [ec] = co_await timer.async_wait(boost::asio::as_tuple(boost::asio::use_awaitable));
+    }
+    co_return true;
+}
+
+void UpstreamPacer::onRateLimited(const std::string& provider, std::optional<std::chrono::seconds> retry_after) {
+    auto now = Clock::now();
+    std::lock_guard lk(m_mtx);
+    auto& pace = m_paces[provider];
+    ++pace.rate_limited;
+    auto hold = retry_after.value_or(std::chrono::seconds(m_cfg.default_retry_after));
+    pace.next_slot = std::max(pace.next_slot, now + hold);
+    // the requests in flight when the limit hit all come back with a 429, only the first one halves the rate
+    if (pace.rate && now - pace.limited_at < hold)
+        return;
+    pace.limited_at = now;
+    auto rate = pace.rate.value_or(0);
+    if (!pace.rate) {
+        auto seconds = std::chrono::duration<double>(now - pace.window_start).count();
+        rate = std::max(pace.arrival_rate, pace.window_requests / std::max(seconds, 1.0));
+    }
+    pace.rate = std::max(rate / 2, m_cfg.min_rate);
+    SPDLOG_WARN("[{}] rate limited, pace at {:.2f} requests/s after a {}s pause", provider, pace.rate.value(),
+                hold.count());
+}
+
+void UpstreamPacer::onSuccess(const std::string& provider) {
+    std::lock_guard lk(m_mtx);
+    auto it = m_paces.find(provider);
+    if (it == m_paces.end() || !it->second.rate)
+        return;
+    auto& rate = it->second.rate;
+    rate.value() += m_cfg.recovery;
+    if (rate.value() > m_cfg.max_rate) {
+        SPDLOG_INFO("[{}] no longer paced", provider);
+        rate.reset();
+    }
+}
+
+nlohmann::json UpstreamPacer::metrics() {
+    std::lock_guard lk(m_mtx);
+    nlohmann::json metrics = nlohmann::json::object();
+    for (auto& [provider, pace] : m_paces) {
+        auto& item = metrics[provider];
+        item["rate"] = pace.rate ? nlohmann::json(pace.rate.value()) : nlohmann::json(nullptr);
+        item["rate_limited"] = pace.rate_limited;
+        item["delayed"] = pace.delayed;
+        item["rejected"] = pace.rejected;
+    }
+    return metrics;
+}
@@ -0,0 +1,105 @@
+#include <cstdint>
+#include <cstring>
+
+#include "utf8_carry.h"
+
+namespace {
+
+constexpr std::string_view REPLACEMENT_CHARACTER{"\xEF\xBF\xBD"};
+
+// length of the sequence a lead byte starts and the range its second byte must be in, 0 for a byte that can't
+// start one (Unicode table 3-7)
+struct Lead {
+    std::size_t length;
+    unsigned char second_min;
+    unsigned char second_max;
+};
+
+Lead lead(unsigned char c) {
+    if (c < 0x80)
+        return {1, 0, 0};
+    if (c >= 0xC2 && c <= 0xDF)
+        return {2, 0x80, 0xBF};
+    if (c == 0xE0)
+        return {3, 0xA0, 0xBF};
+    if (c == 0xED)
+        return {3, 0x80, 0x9F};
+    if (c >= 0xE1 && c <= 0xEF)
+        return {3, 0x80, 0xBF};
+    if (c == 0xF0)
+        return {4, 0x90, 0xBF};
+    if (c == 0xF4)
+        return {4, 0x80, 0x8F};
+    if (c >= 0xF1 && c <= 0xF3)
+        return {4, 0x80, 0xBF};
+    return {0, 0, 0};
+}
+
+}  // namespace
+
+std::string Utf8Carry::feed(std::string chunk) {
+    if (m_carry.empty() && isAscii(chunk))
+        return chunk;
+    std::string data = std::move(m_carry);
+    data.append(chunk);
+    m_carry.clear();
+
+    std::string result;
+    result.reserve(data.size());
+    std::size_t pos = 0;
+    while (pos < data.size()) {
+        auto c = static_cast<unsigned char>(data[pos]);
+        auto [length, second_min, second_max] = lead(c);
+        if (length == 1) {
+            result.push_back(data[pos++]);
+            continue;
+        }
+        if (length == 0) {
+            result.append(REPLACEMENT_CHARACTER);
+            ++pos;
+            continue;
+        }
+        // the longest valid prefix of the sequence, a broken one is replaced as a whole
+        std::size_t valid = 1;
+        while (valid < length && pos + valid < data.size()) {
+            auto next = static_cast<unsigned char>(data[pos + valid]);
+            auto min = valid == 1 ? second_min : 0x80;
+            auto max = valid == 1 ? second_max : 0xBF;
+            if (next < min || next > max)
+                break;
+            ++valid;
+        }
+        if (valid == length) {
+            result.append(data, pos, length);
+        } else if (pos + valid == data.size()) {
+            m_carry.assign(data, pos, valid);
+        } else {
+            result.append(REPLACEMENT_CHARACTER);
+        }
+        pos += valid;
+    }
+    return result;
+}
+
+std::string Utf8Carry::flush() {
+    if (m_carry.empty())
+        return {};
+    m_carry.clear();
+    return std::string{REPLACEMENT_CHARACTER};
+}
+
+bool Utf8Carry::isAscii(std::string_view data) {
+    constexpr uint64_t high_bits{0x8080808080808080};
+    std::size_t pos = 0;
+    for (; pos + sizeof(uint64_t) <= data.size(); pos += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, data.data() + pos, sizeof(word));
+        if (word & high_bits)
+            return false;
+    }
+    for (; pos < data.size(); ++pos) {
+        if (static_cast<unsigned char>(data[pos]) & 0x80)
+            return false;
+    }
+    return true;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <string_view>
+
+// Microbenchmarks of the hot helpers next to the code they replaced, run with `xmake build bench && xmake run bench`.
+// Numbers are the mean wall time of one call after a warm-up, only meaningful relative to each other on one machine.
+
+template <typename T>
+void keep(const T& value) {
+    asm volatile("" : : "r"(&value) : "memory");
+}
+
+template <typename F>
+void measure(std::string_view name, std::size_t iterations, F&& fn) {
+    for (std::size_t i = 0; i < iterations / 10; ++i)
+        keep(fn());
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < iterations; ++i)
+        keep(fn());
+    auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start);
+    std::printf("  %-44.*s %10.1f ns\n", static_cast<int>(name.size()), name.data(),
+                elapsed.count() / static_cast<double>(iterations));
+}
+
+void benchCrypto();
+void benchParsers();
@@ -0,0 +1,84 @@
+#include <cstdint>
+#include <iomanip>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+// the old code called the low level digest functions OpenSSL 3 deprecated
+#define OPENSSL_SUPPRESS_DEPRECATED
+#include <openssl/md5.h>
+#include <openssl/sha.h>
+
+#include "bench.h"
+#include "crypto.h"
+
+namespace {
+
+std::string oldMd5(const std::string& str) {
+    unsigned char hash[MD5_DIGEST_LENGTH];
+
+    MD5_CTX md5;
+    MD5_Init(&md5);
+    MD5_Update(&md5, str.c_str(), str.size());
+    MD5_Final(hash, &md5);
+
+    std::stringstream ss;
+    for (int i = 0; i < MD5_DIGEST_LENGTH; i++)
+        ss << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(hash[i]);
+    return ss.str();
+}
+
+std::string oldSha256(const std::string& s) {
+    unsigned char hash[SHA256_DIGEST_LENGTH];
+    SHA256_CTX sha256;
+    if (!SHA256_Init(&sha256))
+        throw std::runtime_error("SHA-256 initialization failed");
+    if (!SHA256_Update(&sha256, s.c_str(), s.length()))
+        throw std::runtime_error("SHA-256 update failed");
+    if (!SHA256_Final(hash, &sha256))
+        throw std::runtime_error("SHA-256 finalization failed");
+    std::stringstream ss;
+    for (int i = 0; i < SHA256_DIGEST_LENGTH; i++)
+        ss << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(hash[i]);
+    return ss.str();
+}
+
+std::string oldTokenHex(int32_t length) {
+    std::random_device rd;
+    std::stringstream ss;
+    std::mt19937 gen(rd());
+    std::uniform_int_distribution<> dis(0, 15);
+    for (int i = 0; i < length; ++i)
+        ss << std::hex << dis(gen);
+    std::string token = ss.str();
+    token = std::string(length * 2 - token.length(), '0') + token;
+    return token;
+}
+
+uint64_t oldRandom(std::uniform_int_distribution<uint64_t>& dist) {
+    std::random_device rd;
+    std::mt19937 mt(rd());
+    return dist(mt);
+}
+
+}  // namespace
+
+void benchCrypto() {
+    // a signature input of the size the providers hash
+    std::string input = "1697443200000:You are a helpful assistant, answer the question below:7YN8z6d6";
+    if (oldMd5(input) != toHex(md5Digest(input)) || oldSha256(input) != toHex(sha256Digest(input)))
+        throw std::runtime_error("digests differ");
+
+    constexpr std::size_t iterations{200000};
+    std::uniform_int_distribution<uint64_t> dist;
+    std::puts("crypto");
+    measure("md5 hex, MD5_Init + stringstream", iterations, [&] { return oldMd5(input); });
+    measure("md5 hex, md5Digest + toHex", iterations, [&] { return toHex(md5Digest(input)); });
+    measure("sha256 hex, SHA256_Init + stringstream", iterations, [&] { return oldSha256(input); });
+    measure("sha256 hex, sha256Digest + toHex", iterations, [&] { return toHex(sha256Digest(input)); });
+    measure("32 hex digits, random_device + stringstream", iterations / 10, [] { return oldTokenHex(16); });
+    measure("32 hex digits, randomHex", iterations, [] { return randomHex(32); });
+    measure("uint64, random_device + mt19937 per call", iterations / 10, [&] { return oldRandom(dist); });
+    measure("uint64, randomEngine", iterations, [&] { return dist(randomEngine()); });
+}
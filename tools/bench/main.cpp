@@ -0,0 +1,7 @@
+#include "bench.h"
+
+int main() {
+    benchCrypto();
+    benchParsers();
+    return 0;
+}
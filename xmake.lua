@@ -20,3 +20,11 @@ target("cpp-freegpt-webui")
     add_packages("openssl", "yaml_cpp_struct", "nlohmann_json", "spdlog", "boost", "inja", "plusaes", "zlib")
     add_syslinks("pthread", "curl-impersonate-chrome")
 target_end()
+
+-- microbenchmarks of hot helpers against the code they replaced, only built on request: xmake build bench
+target("bench")
+    set_kind("binary")
+    set_default(false)
+    add_files("tools/bench/*.cpp", "src/crypto.cpp", "src/http_parsers.cpp")
+    add_packages("openssl")
+target_end()